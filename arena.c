@@ -0,0 +1,104 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file arena.c
+ * @brief Per-frame bump arena and the debug-build heap allocation guard.
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+/*! @brief The memory of the arena, aligned for any scalar type. */
+static uint64_t FrameArena[FRAME_ARENA_SIZE / sizeof(uint64_t)];
+
+/*! @brief Number of bytes of the arena in use. */
+static uint32 FrameArenaUsed;
+
+void *FrameAlloc(uint32 size)
+{
+	void *p;
+
+	size = (size + 7) & ~7u;
+	if (size > sizeof(FrameArena) - FrameArenaUsed)
+	{
+		OscLog(ERROR, "%s: Frame arena exhausted (%u of %u bytes used)!\n",
+				__func__, (unsigned int)FrameArenaUsed, (unsigned int)sizeof(FrameArena));
+		return NULL;
+	}
+	p = (uint8*)FrameArena + FrameArenaUsed;
+	FrameArenaUsed += size;
+	return p;
+}
+
+void FrameArenaReset(void)
+{
+	FrameArenaUsed = 0;
+}
+
+#ifdef ALLOC_GUARD
+/* The linker redirects malloc, calloc and realloc of the application to
+ * the __wrap_ functions (-Wl,--wrap=malloc etc.), the __real_ ones are
+ * those of the C library. */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+static volatile uint32 nAllocs;
+static __thread bool bAllocGuardArmed;
+static __thread bool bAllocGuardSuspended;
+
+/*! @brief Count an allocation and abort if the guard is armed. */
+static void AllocCheck(const char *strFunc, size_t size)
+{
+	__sync_fetch_and_add(&nAllocs, 1);
+	if (bAllocGuardArmed && !bAllocGuardSuspended)
+	{
+		/* keep the logging itself from recursing in here */
+		bAllocGuardArmed = FALSE;
+		OscLog(ALERT, "%s of %u bytes in the steady-state frame loop!\n",
+				strFunc, (unsigned int)size);
+		abort();
+	}
+}
+
+void *__wrap_malloc(size_t size)
+{
+	AllocCheck("malloc", size);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+	AllocCheck("calloc", n * size);
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+	AllocCheck("realloc", size);
+	return __real_realloc(p, size);
+}
+
+void AllocGuardArm(void)
+{
+	bAllocGuardArmed = TRUE;
+}
+
+void AllocGuardSuspend(void)
+{
+	bAllocGuardSuspended = TRUE;
+}
+
+void AllocGuardResume(void)
+{
+	bAllocGuardSuspended = FALSE;
+}
+
+uint32 AllocGuardCount(void)
+{
+	return nAllocs;
+}
+#endif /* ALLOC_GUARD */
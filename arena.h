@@ -0,0 +1,81 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file arena.h
+ * @brief Per-frame scratch memory and a guard against heap allocations in
+ * the steady-state frame loop.
+ *
+ * Scratch memory of a frame is taken from a static bump arena which is
+ * reset at the start of every frame; nothing is ever freed individually.
+ *
+ * In debug builds (ALLOC_GUARD defined, malloc, calloc and realloc
+ * wrapped by the linker) every heap allocation is counted, and once the
+ * guard is armed for a thread, any allocation from that thread aborts
+ * the application. The linker redirects the calls of every object of the
+ * link, including those taken from the static framework libraries, but
+ * not the calls inside the C library itself (the stdio buffers of fopen,
+ * for example); those are neither counted nor caught.
+ *
+ * Of the framework, the frame loop calls the vision and cycle counter
+ * functions, which work on the buffers they are given, and the camera,
+ * GPIO and simulation functions of the acquire stage. The latter are
+ * drivers (on the host: emulations reading and writing files) whose
+ * allocations are not the application's to remove, so they are called
+ * with the guard suspended (AllocGuardSuspend).
+ */
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "oscar.h"
+
+/*! @brief Size of the per-frame arena, room for small per-frame arrays. */
+#define FRAME_ARENA_SIZE 65536
+
+/*********************************************************************//*!
+ * @brief Allocate scratch memory valid until the next FrameArenaReset.
+ *
+ * @param size Number of bytes, rounded up to a multiple of 8.
+ * @return Pointer to the memory (8 byte aligned) or NULL if the arena is
+ * exhausted.
+ *//*********************************************************************/
+void *FrameAlloc(uint32 size);
+
+/*********************************************************************//*!
+ * @brief Release all memory of the arena; called at the start of every
+ * frame.
+ *//*********************************************************************/
+void FrameArenaReset(void);
+
+#ifdef ALLOC_GUARD
+/*********************************************************************//*!
+ * @brief From now on, abort on any heap allocation of the calling thread.
+ *//*********************************************************************/
+void AllocGuardArm(void);
+
+/*********************************************************************//*!
+ * @brief Let the calling thread allocate until AllocGuardResume, for the
+ * calls into the drivers of the framework.
+ *//*********************************************************************/
+void AllocGuardSuspend(void);
+
+/*********************************************************************//*!
+ * @brief Abort on heap allocations of the calling thread again if the
+ * guard is armed.
+ *//*********************************************************************/
+void AllocGuardResume(void);
+
+/*********************************************************************//*!
+ * @brief Number of heap allocations of all threads so far.
+ *
+ * @return The count.
+ *//*********************************************************************/
+uint32 AllocGuardCount(void);
+#else
+#define AllocGuardArm() do { } while (0)
+#define AllocGuardSuspend() do { } while (0)
+#define AllocGuardResume() do { } while (0)
+#endif /* ALLOC_GUARD */
+
+#endif /*ARENA_H_*/
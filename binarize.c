@@ -0,0 +1,163 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file binarize.c
+ * @brief Branch-free thresholding of gray images (scalar, NEON and SSE2).
+ */
+
+#include "binarize.h"
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BINARIZE_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BINARIZE_SSE2
+#endif
+
+/*! @brief 'p < threshold' is evaluated as 'p <= *pMax'; returns 0 if no
+ * pixel can be below the threshold. */
+static bool ClampThreshold(int threshold, uint8 *pMax)
+{
+	if (threshold <= 0)
+	{
+		*pMax = 0;
+		return FALSE;
+	}
+	*pMax = (threshold > 256) ? 255 : (uint8)(threshold - 1);
+	return TRUE;
+}
+
+#ifdef BINARIZE_NEON
+/*! @brief Collect the top bits of 16 comparison results (0x00/0xff) into
+ * a 16 bit number; NEON has no movemask instruction. */
+static inline uint32 MoveMask_neon(uint8x16_t m)
+{
+	static const uint8 weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint8x16_t b = vandq_u8(m, vld1q_u8(weights));
+	uint8x8_t s = vpadd_u8(vget_low_u8(b), vget_high_u8(b));
+	s = vpadd_u8(s, s);
+	s = vpadd_u8(s, s);
+	return vget_lane_u8(s, 0) | ((uint32)vget_lane_u8(s, 1) << 8);
+}
+#endif /* BINARIZE_NEON */
+
+/*! @brief Threshold the columns from ... to - 1 of a row into bytes;
+ * returns the first column not done by the vector unit. */
+static int BinarizeBytesVector(const uint8 *p, uint8 *q, int from, int to, uint8 tmax, uint8 fg)
+{
+	int c = from;
+#if defined(BINARIZE_NEON)
+	const uint8x16_t tv = vdupq_n_u8(tmax), fv = vdupq_n_u8(fg);
+
+	for (; c + 16 <= to; c += 16)
+	{
+		vst1q_u8(q + c, vandq_u8(vcleq_u8(vld1q_u8(p + c), tv), fv));
+	}
+#elif defined(BINARIZE_SSE2)
+	const __m128i tv = _mm_set1_epi8((char)tmax), fv = _mm_set1_epi8((char)fg);
+
+	for (; c + 16 <= to; c += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(p + c));
+		/* unsigned v <= tmax <=> min(v, tmax) == v */
+		__m128i m = _mm_cmpeq_epi8(_mm_min_epu8(v, tv), v);
+		_mm_storeu_si128((__m128i*)(q + c), _mm_and_si128(m, fv));
+	}
+#endif
+	return c;
+}
+
+void BinarizeBytes(const uint8 *pImg, uint16 width, uint16 height, int threshold, int border, uint8 value, uint8 *pOut)
+{
+	uint8 tmax;
+	/* without any possible foreground pixel, the value is forced to 0 */
+	const uint8 fg = ClampThreshold(threshold, &tmax) ? value : 0;
+	int r, c;
+
+	for (r = 0; r < height; r++)
+	{
+		const uint8 *p = pImg + r * width;
+		uint8 *q = pOut + r * width;
+
+		if (r < border || r >= height - border)
+		{
+			memset(q, 0, width);
+			continue;
+		}
+		memset(q, 0, border);
+		c = BinarizeBytesVector(p, q, border, width - border, tmax, fg);
+		for (; c < width - border; c++)
+		{
+			q[c] = fg & (uint8)-(int)(p[c] <= tmax);
+		}
+		memset(q + width - border, 0, border);
+	}
+}
+
+/*! @brief Threshold 16 pixels into the bits 0 ... 15 of the result. */
+static inline uint32 Binarize16(const uint8 *p, uint8 tmax)
+{
+#if defined(BINARIZE_NEON)
+	return MoveMask_neon(vcleq_u8(vld1q_u8(p), vdupq_n_u8(tmax)));
+#elif defined(BINARIZE_SSE2)
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8((char)tmax)), v));
+#else
+	uint32 bits = 0;
+	int b;
+
+	for (b = 0; b < 16; b++)
+	{
+		bits |= (uint32)(p[b] <= tmax) << b;
+	}
+	return bits;
+#endif
+}
+
+void BinarizeMask(const uint8 *pImg, uint16 width, uint16 height, int threshold, int border, struct BIT_MASK *pMask)
+{
+	uint64_t keep[MASK_MAX_WORDS_PER_ROW];
+	uint8 tmax;
+	const bool bAny = ClampThreshold(threshold, &tmax);
+	int r, c, w;
+
+	MaskInit(pMask, width, height);
+	/* the columns inside the border; without any possible foreground
+	 * pixel nothing is kept at all */
+	memset(keep, 0, sizeof(keep));
+	for (c = border; bAny && c < width - border; c++)
+	{
+		keep[c / 64] |= (uint64_t)1 << (c % 64);
+	}
+
+	for (r = 0; r < height; r++)
+	{
+		const uint8 *p = pImg + r * width;
+		uint64_t *pWords = MASK_ROW(pMask, r);
+
+		if (r < border || r >= height - border)
+		{
+			memset(pWords, 0, pMask->wordsPerRow * sizeof(uint64_t));
+			continue;
+		}
+		for (w = 0; w < pMask->wordsPerRow; w++)
+		{
+			uint64_t word = 0;
+			int end = (64 * w + 64 < width) ? 64 * w + 64 : width;
+
+			for (c = 64 * w; c + 16 <= end; c += 16)
+			{
+				word |= (uint64_t)Binarize16(p + c, tmax) << (c & 63);
+			}
+			for (; c < end; c++)
+			{
+				word |= (uint64_t)(p[c] <= tmax) << (c & 63);
+			}
+			pWords[w] = word & keep[w];
+		}
+	}
+}
@@ -0,0 +1,47 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file binarize.h
+ * @brief Branch-free thresholding of gray images to byte or bit-packed
+ * binary images.
+ *
+ * A pixel is foreground if its gray value is below the threshold. Pixels
+ * closer than 'border' to the image edge are background. Every output
+ * byte (or word) is written exactly once, so the output needs no clearing.
+ */
+#ifndef BINARIZE_H_
+#define BINARIZE_H_
+
+#include "oscar.h"
+#include "bitmask.h"
+
+/*********************************************************************//*!
+ * @brief Threshold a gray image into a byte image.
+ *
+ * @param pImg The gray image (width x height bytes).
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param threshold Pixels below this value are foreground; values below
+ * 1 or above 255 are clamped.
+ * @param border Width of the background border.
+ * @param value Value of foreground pixels (1 for labeling, 255 for display).
+ * @param pOut The byte image to write (width x height bytes).
+ *//*********************************************************************/
+void BinarizeBytes(const uint8 *pImg, uint16 width, uint16 height, int threshold, int border, uint8 value, uint8 *pOut);
+
+/*********************************************************************//*!
+ * @brief Threshold a gray image into a bit-packed mask.
+ *
+ * @param pImg The gray image (width x height bytes).
+ * @param width Width of the image.
+ * @param height Height of the image.
+ * @param threshold Pixels below this value are foreground; values below
+ * 1 or above 255 are clamped.
+ * @param border Width of the background border.
+ * @param pMask The mask to write; it gets the size of the image.
+ *//*********************************************************************/
+void BinarizeMask(const uint8 *pImg, uint16 width, uint16 height, int threshold, int border, struct BIT_MASK *pMask);
+
+#endif /*BINARIZE_H_*/
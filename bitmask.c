@@ -0,0 +1,131 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file bitmask.c
+ * @brief Bit-packed binary images and word-parallel morphology on them.
+ */
+
+#include "bitmask.h"
+#include <string.h>
+
+void MaskInit(struct BIT_MASK *pMask, uint16 width, uint16 height)
+{
+	pMask->width = width;
+	pMask->height = height;
+	pMask->wordsPerRow = (width + 63) / 64;
+}
+
+void MaskToBytes(const struct BIT_MASK *pMask, uint8 *pImg, uint8 value)
+{
+	int r, w, b;
+
+	for (r = 0; r < pMask->height; r++)
+	{
+		uint8 *pRow = pImg + r * pMask->width;
+		const uint64_t *pWords = MASK_ROW(pMask, r);
+
+		for (w = 0; w < pMask->wordsPerRow; w++)
+		{
+			int n = pMask->width - 64 * w;
+			uint64_t word = pWords[w];
+
+			if (n > 64)
+				n = 64;
+			for (b = 0; b < n; b++)
+			{
+				/* -(bit) is either all ones or zero */
+				pRow[64 * w + b] = value & (uint8)-(int)((word >> b) & 1);
+			}
+		}
+	}
+}
+
+/*! @brief The words of a row with the 'border' left- and rightmost
+ * columns (and the padding) cleared. */
+static void MaskColumnsInside(const struct BIT_MASK *pMask, int border, uint64_t *pKeep)
+{
+	int w, c;
+
+	for (w = 0; w < pMask->wordsPerRow; w++)
+	{
+		pKeep[w] = 0;
+	}
+	for (c = border; c < pMask->width - border; c++)
+	{
+		pKeep[c / 64] |= (uint64_t)1 << (c % 64);
+	}
+}
+
+void MaskClearBorderRows(struct BIT_MASK *pMask, int border, int firstRow, int endRow)
+{
+	uint64_t keep[MASK_MAX_WORDS_PER_ROW];
+	int r, w;
+
+	MaskColumnsInside(pMask, border, keep);
+	for (r = firstRow; r < endRow; r++)
+	{
+		uint64_t *pWords = MASK_ROW(pMask, r);
+
+		for (w = 0; w < pMask->wordsPerRow; w++)
+		{
+			pWords[w] = (r < border || r >= pMask->height - border) ? 0 : (pWords[w] & keep[w]);
+		}
+	}
+}
+
+/*! @brief Common implementation of the 3x3 erosion and dilation: the
+ * vertical neighbors are combined word by word, the horizontal ones by
+ * shifting in the adjacent bits of the neighboring words. */
+static void Mask3x3(const struct BIT_MASK *pIn, struct BIT_MASK *pOut, int border, int firstRow, int endRow, bool bErode)
+{
+	uint64_t keep[MASK_MAX_WORDS_PER_ROW];
+	uint64_t vert[MASK_MAX_WORDS_PER_ROW + 2];
+	const int nw = pIn->wordsPerRow;
+	int r, w;
+
+	MaskColumnsInside(pIn, border, keep);
+	/* the words left of the first and right of the last one */
+	vert[0] = vert[nw + 1] = 0;
+
+	for (r = firstRow; r < endRow; r++)
+	{
+		uint64_t *pDst = MASK_ROW(pOut, r);
+
+		if (r < border || r >= pIn->height - border)
+		{
+			memset(pDst, 0, nw * sizeof(uint64_t));
+			continue;
+		}
+		{
+			const uint64_t *pUp = MASK_ROW(pIn, r - 1);
+			const uint64_t *pMid = MASK_ROW(pIn, r);
+			const uint64_t *pDown = MASK_ROW(pIn, r + 1);
+
+			for (w = 0; w < nw; w++)
+			{
+				vert[w + 1] = bErode ? (pUp[w] & pMid[w] & pDown[w]) : (pUp[w] | pMid[w] | pDown[w]);
+			}
+		}
+		for (w = 0; w < nw; w++)
+		{
+			uint64_t v = vert[w + 1];
+			/* bit c of 'left' is pixel c-1, bit c of 'right' is pixel c+1 */
+			uint64_t left = (v << 1) | (vert[w] >> 63);
+			uint64_t right = (v >> 1) | (vert[w + 2] << 63);
+
+			pDst[w] = (bErode ? (left & v & right) : (left | v | right)) & keep[w];
+		}
+	}
+}
+
+void MaskErode3x3(const struct BIT_MASK *pIn, struct BIT_MASK *pOut, int border, int firstRow, int endRow)
+{
+	Mask3x3(pIn, pOut, border, firstRow, endRow, TRUE);
+}
+
+void MaskDilate3x3(const struct BIT_MASK *pIn, struct BIT_MASK *pOut, int border, int firstRow, int endRow)
+{
+	Mask3x3(pIn, pOut, border, firstRow, endRow, FALSE);
+}
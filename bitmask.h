@@ -0,0 +1,99 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file bitmask.h
+ * @brief Bit-packed binary images and word-parallel morphology on them.
+ *
+ * A mask stores one bit per pixel. Pixel (r, c) is bit (c % 64) of word
+ * (c / 64) of row r; every row is padded to a multiple of 64 bits and the
+ * padding bits are always zero.
+ */
+#ifndef BITMASK_H_
+#define BITMASK_H_
+
+#include "oscar.h"
+#include <stdint.h>
+
+/*! @brief Number of 64 bit words of a mask row of maximal width. */
+#define MASK_MAX_WORDS_PER_ROW ((OSC_CAM_MAX_IMAGE_WIDTH + 63) / 64)
+
+/*! @brief A bit-packed binary image. */
+struct BIT_MASK
+{
+	/*! @brief Width of the image in pixels. */
+	uint16 width;
+	/*! @brief Height of the image in pixels. */
+	uint16 height;
+	/*! @brief Number of used 64 bit words per row. */
+	uint16 wordsPerRow;
+	/*! @brief The pixels, row after row. */
+	uint64_t words[OSC_CAM_MAX_IMAGE_HEIGHT * MASK_MAX_WORDS_PER_ROW];
+};
+
+/*! @brief Pointer to the first word of row r of a mask. */
+#define MASK_ROW(pMask, r) (&(pMask)->words[(r) * (pMask)->wordsPerRow])
+
+/*********************************************************************//*!
+ * @brief Set the size of a mask; the contents are undefined afterwards.
+ *
+ * @param pMask The mask.
+ * @param width Width in pixels, at most OSC_CAM_MAX_IMAGE_WIDTH.
+ * @param height Height in pixels, at most OSC_CAM_MAX_IMAGE_HEIGHT.
+ *//*********************************************************************/
+void MaskInit(struct BIT_MASK *pMask, uint16 width, uint16 height);
+
+/*********************************************************************//*!
+ * @brief Unpack a mask into a byte image.
+ *
+ * Every byte of the image is written: set pixels get the value 'value',
+ * the others 0.
+ *
+ * @param pMask The mask to read.
+ * @param pImg The byte image of the size of the mask.
+ * @param value Value of set pixels (1 for labeling, 255 for display).
+ *//*********************************************************************/
+void MaskToBytes(const struct BIT_MASK *pMask, uint8 *pImg, uint8 value);
+
+/*********************************************************************//*!
+ * @brief Clear the pixels closer than 'border' to the image edge within
+ * the rows firstRow ... endRow - 1.
+ *
+ * @param pMask The mask.
+ * @param border Width of the border.
+ * @param firstRow First row to process.
+ * @param endRow Row after the last one to process.
+ *//*********************************************************************/
+void MaskClearBorderRows(struct BIT_MASK *pMask, int border, int firstRow, int endRow);
+
+/*********************************************************************//*!
+ * @brief Erosion with a 3x3 square, 64 pixels per operation.
+ *
+ * Only the rows firstRow ... endRow - 1 of the output are written, so
+ * horizontal stripes of a mask can be processed in parallel. Pixels closer
+ * than 'border' to the image edge are cleared.
+ *
+ * @param pIn The mask to read.
+ * @param pOut The mask to write (must not be pIn), of the size of pIn.
+ * @param border Width of the cleared border, at least 1.
+ * @param firstRow First row to write.
+ * @param endRow Row after the last one to write.
+ *//*********************************************************************/
+void MaskErode3x3(const struct BIT_MASK *pIn, struct BIT_MASK *pOut, int border, int firstRow, int endRow);
+
+/*********************************************************************//*!
+ * @brief Dilation with a 3x3 square, 64 pixels per operation.
+ *
+ * Only the rows firstRow ... endRow - 1 of the output are written. Pixels
+ * closer than 'border' to the image edge are cleared.
+ *
+ * @param pIn The mask to read.
+ * @param pOut The mask to write (must not be pIn), of the size of pIn.
+ * @param border Width of the cleared border, at least 1.
+ * @param firstRow First row to write.
+ * @param endRow Row after the last one to write.
+ *//*********************************************************************/
+void MaskDilate3x3(const struct BIT_MASK *pIn, struct BIT_MASK *pOut, int border, int firstRow, int endRow);
+
+#endif /*BITMASK_H_*/
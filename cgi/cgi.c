@@ -10,8 +10,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "cgi.h"
@@ -27,8 +32,6 @@
 const int sizRect = sizeof(struct IMG_RECT);
 const int sizLine = sizeof(struct IMG_LINE);
 const int sizString = sizeof(struct IMG_STRING);
-const int nc = OSC_CAM_MAX_IMAGE_WIDTH;
-const int nr = OSC_CAM_MAX_IMAGE_HEIGHT;
 const int siz = OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT;
 
 const int colorLUT[MAX_NUM_COLORS][3] = {{255, 255, 255}, {0, 0, 0}, {255, 0, 0}, {0, 255, 0}, {0, 0, 255},
@@ -44,7 +47,13 @@ struct ARGUMENT args[] =
 	{ "exposureTime", INT_ARG, &cgi.args.nExposureTime, &cgi.args.bExposureTime_supplied },
 	{ "Threshold", INT_ARG, &cgi.args.nThreshold, &cgi.args.bThreshold_supplied },
 	{ "ImageType", INT_ARG, &cgi.args.nImageType, &cgi.args.bImageType_supplied },
-	{ "AddInfo", INT_ARG, &cgi.args.nAddInfo, &cgi.args.bAddInfo_supplied }
+	{ "AddInfo", INT_ARG, &cgi.args.nAddInfo, &cgi.args.bAddInfo_supplied },
+	{ "MorphOp", INT_ARG, &cgi.args.nMorphOp, &cgi.args.bMorphOp_supplied },
+	{ "MorphWidth", INT_ARG, &cgi.args.nMorphWidth, &cgi.args.bMorphWidth_supplied },
+	{ "MorphHeight", INT_ARG, &cgi.args.nMorphHeight, &cgi.args.bMorphHeight_supplied },
+	{ "ColorClasses", STRING_ARG, cgi.args.strColorClasses, &cgi.args.bColorClasses_supplied },
+	{ "OtsuSampleStep", INT_ARG, &cgi.args.nOtsuSampleStep, &cgi.args.bOtsuSampleStep_supplied },
+	{ "ImageFrame", INT_ARG, &cgi.args.nImageFrame, &cgi.args.bImageFrame_supplied }
 };
 
 
@@ -155,223 +164,510 @@ static OSC_ERR CGIParseArguments()
 }
 
 /*********************************************************************//*!
- * @brief Query the current state of the application and see what else
- * we need to get from it
+ * @brief Connect to the socket of the application.
  *
- * Depending on the current state of the application, other additional
- * parameters may be queried.
+ * @return SUCCESS or an appropriate error code otherwise
+ *//*********************************************************************/
+static OSC_ERR IpcConnect()
+{
+	struct sockaddr_un addr;
+
+	cgi.ipcSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (cgi.ipcSocket < 0)
+	{
+		OscLog(ERROR, "CGI %s: Unable to create the socket (%d)!\n", __func__, errno);
+		return -EDEVICE;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, USER_INTERFACE_SOCKET_PATH, sizeof(addr.sun_path) - 1);
+	if (connect(cgi.ipcSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		OscLog(ERROR, "CGI %s: Unable to connect to the application (%d)!\n", __func__, errno);
+		close(cgi.ipcSocket);
+		cgi.ipcSocket = -1;
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Map the frames published by the application.
  *
  * @return SUCCESS or an appropriate error code otherwise
  *//*********************************************************************/
-static OSC_ERR QueryApp()
+static OSC_ERR MapImageRing()
 {
-	OSC_ERR err;
+	void *p;
+	const int fd = shm_open(IMAGE_SHM_NAME, O_RDONLY, 0);
 
-	/* First, get the current state of the algorithm. */
-	err = OscIpcGetParam(cgi.ipcChan, &cgi.appState, GET_APP_STATE, sizeof(struct APPLICATION_STATE));
-	if (err != SUCCESS)
+	if (fd < 0)
 	{
-		/* This request is defined in all states, and thus must succeed. */
-		OscLog(ERROR, "CGI: Error querying application! (%d)\n", err);
-		return err;
+		OscLog(ERROR, "CGI %s: Unable to open %s (%d)!\n", __func__, IMAGE_SHM_NAME, errno);
+		return -EDEVICE;
 	}
+	p = mmap(NULL, sizeof(struct IMAGE_RING), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		OscLog(ERROR, "CGI %s: Unable to map %s (%d)!\n", __func__, IMAGE_SHM_NAME, errno);
+		return -EDEVICE;
+	}
+	cgi.pImageRing = p;
+	return SUCCESS;
+}
 
-	switch(cgi.appState.enAppMode)
+/*********************************************************************//*!
+ * @brief Send or receive a number of bytes on the connection to the
+ * application.
+ *
+ * @param bSend Whether to send.
+ * @param pBuf The bytes.
+ * @param size The number of bytes.
+ * @return SUCCESS or an appropriate error code otherwise
+ *//*********************************************************************/
+static OSC_ERR IpcTransfer(bool bSend, void *pBuf, uint32 size)
+{
+	uint8 *p = (uint8*)pBuf;
+	ssize_t result;
+
+	while (size > 0)
 	{
-	case APP_OFF:
-		/* Algorithm is off, nothing else to do. */
-		break;
-	case APP_CAPTURE_ON:
-		if (cgi.appState.bNewImageReady)
+		if (bSend)
+			result = send(cgi.ipcSocket, p, size, MSG_NOSIGNAL);
+		else
+			result = recv(cgi.ipcSocket, p, size, 0);
+		if (result <= 0)
 		{
-			FILE* F;
-			uint16 r,c;
-			uint8* pData;
-			uint32 dataSiz, i;
-			uint16 oType;
-
-			/* If there is a new image ready, request it from the application. */
-			/* We get TWICE the size of an image because metadata might be available */
-			err = OscIpcGetParam(cgi.ipcChan, cgi.imgBuf, GET_NEW_IMG, NUM_COLORS*nc*nr*2);
-			if (err != SUCCESS)
-			{
-				OscLog(DEBUG, "CGI: Getting new image failed! (%d)\n", err);
-				return err;
-			}
+			if (result < 0 && errno == EINTR)
+				continue;
+			OscLog(ERROR, "CGI %s: Connection to the application lost (%d)!\n", __func__, errno);
+			return -EDEVICE;
+		}
+		p += result;
+		size -= result;
+	}
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Send a request to the application and receive its reply.
+ *
+ * @param paramId The parameter (enum EnIpcParamIds).
+ * @param pValue The value to set, NULL for a get request.
+ * @param valueSize The size of the value.
+ * @param pReply The buffer for the value of the reply.
+ * @param replySize The size of the buffer.
+ * @return SUCCESS, -ENEGATIVE_ACKNOWLEDGE or an appropriate error code
+ * otherwise
+ *//*********************************************************************/
+static OSC_ERR IpcRequest(uint32 paramId, const void *pValue, uint32 valueSize, void *pReply, uint32 replySize)
+{
+	const bool bSet = (pValue != NULL);
+	struct IPC_REQUEST_HEADER request = { paramId, bSet, bSet ? valueSize : replySize };
+	struct IPC_REPLY_HEADER reply;
+	OSC_ERR err;
+
+	err = IpcTransfer(TRUE, &request, sizeof(request));
+	if (err == SUCCESS && bSet)
+		err = IpcTransfer(TRUE, (void*)pValue, valueSize);
+	if (err == SUCCESS)
+		err = IpcTransfer(FALSE, &reply, sizeof(reply));
+	if (err != SUCCESS)
+		return err;
+	if (reply.err != SUCCESS)
+		return reply.err;
+	if (reply.length > replySize)
+	{
+		OscLog(ERROR, "CGI %s: Reply too large (%u bytes)!\n", __func__, reply.length);
+		return -EBUFFER_TOO_SMALL;
+	}
+	return IpcTransfer(FALSE, pReply, reply.length);
+}
+
+/*********************************************************************//*!
+ * @brief Create a gd image from an image of the application.
+ *
+ * @param pHeader The geometry of the image.
+ * @param pImg The image.
+ * @return The gd image.
+ *//*********************************************************************/
+static gdImagePtr CreateImage(const struct IMAGE_HEADER *pHeader, const uint8 *pImg)
+{
+	const uint16 nc = pHeader->width, nr = pHeader->height, stride = pHeader->stride;
+	uint16 r,c;
+
 //we have to take care of the different ways gdlib treats gray and color data
 #if NUM_COLORS == 1
-			//create gd image and ...
-			gdImagePtr im_out =  gdImageCreate(nc, nr);
-			//initialize with sensor image
-			for(r = 0; r < nr; r++)
-			{
-				//in case the original image should not be modified replace the following loop by the memcpy statement
-				//memcpy(im_out->pixels[r], cgi.imgBuf+r*nc, nc*sizeof(uint8));
-				for(c = 0; c < nc; c++)
-				{
-					im_out->pixels[r][c] = (*(cgi.imgBuf+r*nc+c) & 0xfe);//mask out first bit -> only even gray values
-				}
-			}
-			//allocate color palette (255 is red -> we did not change the sensor image!! should rather use a LUT)
-			for(c = 0; c < 256; c++)
-			{
-				if((c%2) && c > 255-2*MAX_NUM_COLORS){
-					i = (255-c)/2;
-					gdImageColorAllocate (im_out, colorLUT[i][0], colorLUT[i][1], colorLUT[i][2]);
-				} else {
-					gdImageColorAllocate (im_out, c, c, c);
-				}
-			}
+	//create gd image and ...
+	gdImagePtr im_out =  gdImageCreate(nc, nr);
+	//initialize with sensor image
+	for(r = 0; r < nr; r++)
+	{
+		//in case the original image should not be modified replace the following loop by the memcpy statement
+		//memcpy(im_out->pixels[r], pImg+r*stride, nc*sizeof(uint8));
+		for(c = 0; c < nc; c++)
+		{
+			im_out->pixels[r][c] = (*(pImg+r*stride+c) & 0xfe);//mask out first bit -> only even gray values
+		}
+	}
+	//allocate color palette (255 is red -> we did not change the sensor image!! should rather use a LUT)
+	for(c = 0; c < 256; c++)
+	{
+		if((c%2) && c > 255-2*MAX_NUM_COLORS){
+			uint32 i = (255-c)/2;
+			gdImageColorAllocate (im_out, colorLUT[i][0], colorLUT[i][1], colorLUT[i][2]);
+		} else {
+			gdImageColorAllocate (im_out, c, c, c);
+		}
+	}
 #else
-			//create gd image and ...
-			gdImagePtr im_out =  gdImageCreateTrueColor(nc, nr);
-			//initialize with sensor image
-			for(r = 0; r < nr; r++)
-			{
-				for(c = 0; c < nc; c++)
-				{
-					uint8* p = (cgi.imgBuf+r*3*nc+3*c);
-					im_out->tpixels[r][c] = gdTrueColor(p[2], p[1], p[0]);
-				}
-			}
+	//create gd image and ...
+	gdImagePtr im_out =  gdImageCreateTrueColor(nc, nr);
+	//initialize with sensor image
+	for(r = 0; r < nr; r++)
+	{
+		for(c = 0; c < nc; c++)
+		{
+			const uint8* p = (pImg+r*stride+3*c);
+			im_out->tpixels[r][c] = gdTrueColor(p[2], p[1], p[0]);
+		}
+	}
 
 
 #endif
-			//there might be additional data to be written to image
-			pData = (uint8*) (cgi.imgBuf+NUM_COLORS*nc*nr);
-			memcpy(&dataSiz, pData, sizeof(uint32));
-			//OscLog(DEBUG, "received %d number of bytes\n", dataSiz);
-			pData += sizeof(uint32);//skip dataSiz
-			if(dataSiz)
-			{
-				i = 0;
-				while(i < dataSiz)
+	return im_out;
+}
+
+/*********************************************************************//*!
+ * @brief Draw the drawing info of the application into an image.
+ *
+ * @param im_out The image.
+ * @param pData The drawing info.
+ * @param dataSiz The size of the drawing info.
+ *//*********************************************************************/
+static void DrawAddInfo(gdImagePtr im_out, const uint8 *pData, uint32 dataSiz)
+{
+	uint32 i;
+	uint16 oType;
+
+	if(dataSiz)
+	{
+		i = 0;
+		while(i < dataSiz)
+		{
+			memcpy(&oType, pData+i, sizeof(uint16));
+			i += sizeof(uint16);
+			switch(oType) {
+				case OBJ_LINE:
+				{
+					struct IMG_LINE imgLine;
+					memcpy(&imgLine, pData+i, sizLine);
+					i += sizLine;
+					//OscLog(DEBUG, "received line (%d,%d)-(%d,%d), color(%d)\n", imgLine.x1, imgLine.y1, imgLine.x2, imgLine.y2, (int) imgLine.color);
+					gdImageLine(im_out, imgLine.x1, imgLine.y1, imgLine.x2, imgLine.y2, colorLoolUp(imgLine.color));
+					break;
+				}
+				case OBJ_RECT:
 				{
-					memcpy(&oType, pData+i, sizeof(uint16));
-					i += sizeof(uint16);
-					switch(oType) {
-						case OBJ_LINE:
-						{
-							struct IMG_LINE imgLine;
-							memcpy(&imgLine, pData+i, sizLine);
-							i += sizLine;
-							//OscLog(DEBUG, "received line (%d,%d)-(%d,%d), color(%d)\n", imgLine.x1, imgLine.y1, imgLine.x2, imgLine.y2, (int) imgLine.color);
-							gdImageLine(im_out, imgLine.x1, imgLine.y1, imgLine.x2, imgLine.y2, colorLoolUp(imgLine.color));
+					struct IMG_RECT imgRect;
+					memcpy(&imgRect, pData+i, sizRect);
+					i += sizRect;
+					//OscLog(DEBUG, "received rect (%d,%d)-(%d,%d), %s, color(%d)\n", imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, imgRect.recFill ? "fill" : "not fill", (int) imgRect.color);
+					if(imgRect.recFill) {
+						gdImageFilledRectangle(im_out, imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, colorLoolUp(imgRect.color));
+					} else {
+						gdImageRectangle(im_out, imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, colorLoolUp(imgRect.color));
+					}
+					break;
+				}
+				case OBJ_STRING:
+				{
+					gdFontPtr font = gdFontSmall;
+					struct IMG_STRING imgString;
+					memcpy(&imgString, pData+i, sizRect);
+					i += sizString;
+					//OscLog(DEBUG, "received string (%d,%d), font %d, %s, color(%d)\n", imgString.xPos, imgString.yPos, imgString.font, pData+i, imgString.color);
+					switch(imgString.font)
+					{
+						case GIANT:
+							font = gdFontGiant;
+							break;
+						case LARGE:
+							font = gdFontLarge;
 							break;
-						}
-						case OBJ_RECT:
-						{
-							struct IMG_RECT imgRect;
-							memcpy(&imgRect, pData+i, sizRect);
-							i += sizRect;
-							//OscLog(DEBUG, "received rect (%d,%d)-(%d,%d), %s, color(%d)\n", imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, imgRect.recFill ? "fill" : "not fill", (int) imgRect.color);
-							if(imgRect.recFill) {
-								gdImageFilledRectangle(im_out, imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, colorLoolUp(imgRect.color));
-							} else {
-								gdImageRectangle(im_out, imgRect.left, imgRect.bottom, imgRect.right, imgRect.top, colorLoolUp(imgRect.color));
-							}
+						case MEDIUMBOLD:
+							font = gdFontMediumBold;
 							break;
-						}
-						case OBJ_STRING:
-						{
-							gdFontPtr font = gdFontSmall;
-							struct IMG_STRING imgString;
-							memcpy(&imgString, pData+i, sizRect);
-							i += sizString;
-							//OscLog(DEBUG, "received string (%d,%d), font %d, %s, color(%d)\n", imgString.xPos, imgString.yPos, imgString.font, pData+i, imgString.color);
-							switch(imgString.font)
-							{
-								case GIANT:
-									font = gdFontGiant;
-									break;
-								case LARGE:
-									font = gdFontLarge;
-									break;
-								case MEDIUMBOLD:
-									font = gdFontMediumBold;
-									break;
-								case SMALL:
-									font = gdFontSmall;
-									break;
-								case TINY:
-									font = gdFontTiny;
-									break;
-								default:
-									break;//set in definition of font
-							}
-							gdImageString(im_out, font, imgString.xPos, imgString.yPos, pData+i, colorLoolUp(imgString.color));
-						}
+						case SMALL:
+							font = gdFontSmall;
+							break;
+						case TINY:
+							font = gdFontTiny;
+							break;
+						default:
+							break;//set in definition of font
 					}
+					gdImageString(im_out, font, imgString.xPos, imgString.yPos, (unsigned char*)pData+i, colorLoolUp(imgString.color));
 				}
 			}
+		}
+	}
+}
+
+/*********************************************************************//*!
+ * @brief Write a frame published by the application to the image file.
+ *
+ * The pixels are converted right from the shared memory as the header of
+ * the frame describes them; the drawing info is copied, so that it is
+ * known to be whole before it is parsed.
+ *
+ * @param nFrame The frame, counted as IMAGE_RING.nPublished.
+ * @return SUCCESS or -ETIMEOUT if the frame was overwritten already or
+ * while it was read.
+ *//*********************************************************************/
+static OSC_ERR WriteImage(uint32 nFrame)
+{
+	const struct IMAGE_SLOT *pSlot = &cgi.pImageRing->slots[(nFrame - 1) % NR_IMAGE_SLOTS];
+	const uint32 seq = ImageSlotReadBegin(pSlot);
+	struct IMAGE_HEADER header;
+	uint32 dataSiz;
+	gdImagePtr im_out;
+	FILE* F;
+
+	if (seq != ImageSlotFrameSeq(nFrame))
+	{
+		/* the slot holds another frame by now */
+		return -ETIMEOUT;
+	}
+	header = pSlot->header;
+	/* a header torn by the application may describe anything */
+	if (header.channels != NUM_COLORS || header.width > OSC_CAM_MAX_IMAGE_WIDTH ||
+			header.height > OSC_CAM_MAX_IMAGE_HEIGHT ||
+			header.stride < NUM_COLORS*header.width || header.addInfoSize >= sizeof(cgi.addInfo) ||
+			ImageDataSize(&header) > sizeof(pSlot->data))
+	{
+		return -ETIMEOUT;
+	}
+	im_out = CreateImage(&header, pSlot->data);
+	dataSiz = header.addInfoSize;
+	memcpy(cgi.addInfo, pSlot->data + (uint32)header.stride*header.height, dataSiz);
+	if (!ImageSlotReadValid(pSlot, seq))
+	{
+		gdImageDestroy(im_out);
+		return -ETIMEOUT;
+	}
+	cgi.addInfo[dataSiz] = 0;
+	DrawAddInfo(im_out, cgi.addInfo, dataSiz);
+
+	F = fopen(IMG_FN, "wb");
+	//gdImageGif(im_out, F);
+	gdImageJpeg(im_out, F, 100);
+	fclose(F);
+	gdImageDestroy(im_out);
+	/* the image written */
+	cgi.appState.imageTimeStamp = header.imageTimeStamp;
+	cgi.appState.nImageFrame = nFrame;
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Write the newest frame published by the application to the
+ * image file.
+ *
+ * @return SUCCESS or -ENEGATIVE_ACKNOWLEDGE if the application overwrote
+ * the frames faster than they were read.
+ *//*********************************************************************/
+static OSC_ERR WriteNewestImage()
+{
+	int i;
 
-			F = fopen(IMG_FN, "wb");
-			//gdImageGif(im_out, F);
-			gdImageJpeg(im_out, F, 100);
-			fclose(F);
-			gdImageDestroy(im_out);
+	for (i = 0; i < NR_IMAGE_SLOTS; i++)
+	{
+		const uint32 nPublished = __atomic_load_n(&cgi.pImageRing->nPublished, __ATOMIC_ACQUIRE);
 
+		if (nPublished == 0 || WriteImage(nPublished) == SUCCESS)
+		{
+			/* written, or nothing published yet */
 			return SUCCESS;
 		}
-		break;
-	default:
-		OscLog(ERROR, "%s: Invalid application mode (%d)!\n", __func__, cgi.appState.enAppMode);
-		break;
+	}
+	OscLog(DEBUG, "CGI: The images were overwritten while read!\n");
+	return -ENEGATIVE_ACKNOWLEDGE;
+}
+
+/*********************************************************************//*!
+ * @brief Parse a list of color classes.
+ *
+ * The classes are separated by ';', each class consists of the four
+ * numbers cb,cr,radius,color (color as in enum ObjColor).
+ *
+ * @param str The string to be parsed.
+ * @param pTable The table to be filled in.
+ * @return SUCCESS or an appropriate error code otherwise
+ *//*********************************************************************/
+static OSC_ERR ParseColorClasses(const char *str, struct COLOR_CLASS_TABLE *pTable)
+{
+	memset(pTable, 0, sizeof(struct COLOR_CLASS_TABLE));
+
+	while (*str != 0)
+	{
+		unsigned int cb, cr, radius, color;
+		int len;
+
+		if (pTable->nClasses >= MAX_NUM_COLOR_CLASSES ||
+				sscanf(str, " %u , %u , %u , %u %n", &cb, &cr, &radius, &color, &len) != 4 ||
+				cb > 255 || cr > 255 || radius > 255 || color >= MAX_NUM_COLORS)
+		{
+			OscLog(ERROR, "%s: Invalid color class list: \"%s\"\n", __func__, str);
+			return -EINVALID_PARAMETER;
+		}
+		pTable->classes[pTable->nClasses].cb = cb;
+		pTable->classes[pTable->nClasses].cr = cr;
+		pTable->classes[pTable->nClasses].radius = radius;
+		pTable->classes[pTable->nClasses].color = color;
+		pTable->nClasses++;
+
+		str += len;
+		if (*str == ';')
+			str++;
 	}
 	return SUCCESS;
 }
 
 /*********************************************************************//*!
- * @brief Set the parameters for the application supplied by the web
+ * @brief Collect the parameters for the application supplied by the web
  * interface.
  *
+ * @param pOptions Receives the parameters supplied.
  * @return SUCCESS or an appropriate error code otherwise
  *//*********************************************************************/
-static OSC_ERR SetOptions()
+static OSC_ERR CollectOptions(struct IPC_OPTIONS *pOptions)
 {
-	OSC_ERR err;
 	struct ARGUMENT_DATA *pArgs = &cgi.args;
 
+	memset(pOptions, 0, sizeof(struct IPC_OPTIONS));
+
 	if (pArgs->bImageType_supplied)
 	{
-		err = OscIpcSetParam(cgi.ipcChan, &pArgs->nImageType, SET_IMAGE_TYPE, sizeof(pArgs->nImageType));
-		if (err != SUCCESS)
-		{
-			OscLog(DEBUG, "CGI: Error setting option! (%d)\n", err);
-			return err;
-		}
+		pOptions->nImageType = pArgs->nImageType;
+		pOptions->setFlags |= OPT_IMAGE_TYPE;
 	}
-
 	if (pArgs->bThreshold_supplied)
 	{
-		err = OscIpcSetParam(cgi.ipcChan, &pArgs->nThreshold, SET_THRESHOLD, sizeof(pArgs->nThreshold));
-		if (err != SUCCESS)
-		{
-			OscLog(DEBUG, "CGI: Error setting option! (%d)\n", err);
-			return err;
-		}
+		pOptions->nThreshold = pArgs->nThreshold;
+		pOptions->setFlags |= OPT_THRESHOLD;
 	}
-
 	if (pArgs->bExposureTime_supplied)
 	{
-		err = OscIpcSetParam(cgi.ipcChan, &pArgs->nExposureTime, SET_EXPOSURE_TIME, sizeof(pArgs->nExposureTime));
-		if (err != SUCCESS)
-		{
-			OscLog(DEBUG, "CGI: Error setting option! (%d)\n", err);
-			return err;
-		}
+		pOptions->nExposureTime = pArgs->nExposureTime;
+		pOptions->setFlags |= OPT_EXPOSURE_TIME;
 	}
-
 	if (pArgs->bAddInfo_supplied)
 	{
-		err = OscIpcSetParam(cgi.ipcChan, &pArgs->nAddInfo, SET_ADDINFO, sizeof(pArgs->nAddInfo));
+		pOptions->nAddInfo = pArgs->nAddInfo;
+		pOptions->setFlags |= OPT_ADDINFO;
+	}
+	/* arguments not supplied keep their current value */
+	if (pArgs->bMorphOp_supplied)
+	{
+		pOptions->morph.op = pArgs->nMorphOp;
+		pOptions->setFlags |= OPT_MORPH_OP;
+	}
+	if (pArgs->bMorphWidth_supplied)
+	{
+		pOptions->morph.width = pArgs->nMorphWidth;
+		pOptions->setFlags |= OPT_MORPH_WIDTH;
+	}
+	if (pArgs->bMorphHeight_supplied)
+	{
+		pOptions->morph.height = pArgs->nMorphHeight;
+		pOptions->setFlags |= OPT_MORPH_HEIGHT;
+	}
+	if (pArgs->bOtsuSampleStep_supplied)
+	{
+		pOptions->nOtsuSampleStep = pArgs->nOtsuSampleStep;
+		pOptions->setFlags |= OPT_OTSU_SAMPLE_STEP;
+	}
+	if (pArgs->bColorClasses_supplied)
+	{
+		OSC_ERR err = ParseColorClasses(pArgs->strColorClasses, &pOptions->colorClasses);
 		if (err != SUCCESS)
 		{
-			OscLog(DEBUG, "CGI: Error setting option! (%d)\n", err);
 			return err;
 		}
+		pOptions->setFlags |= OPT_COLOR_CLASSES;
+	}
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Wait until the application published a frame other than the
+ * one the web interface shows, at most about a second.
+ *
+ * @return SUCCESS or an appropriate error code otherwise
+ *//*********************************************************************/
+static OSC_ERR WaitNewFrame()
+{
+	uint32 nFrame = cgi.args.nImageFrame;
+
+	return IpcRequest(WAIT_NEW_FRAME, &nFrame, sizeof(nFrame), &nFrame, sizeof(nFrame));
+}
+
+/*********************************************************************//*!
+ * @brief Set the parameters supplied by the web interface and query the
+ * state of the application they result in, in one request, and write the
+ * frame the state shows.
+ *
+ * The application sets all of the parameters or, if one is invalid, none;
+ * then only the state is queried.
+ *
+ * @return SUCCESS, -ENEGATIVE_ACKNOWLEDGE if the frames were overwritten
+ * faster than they were read or an appropriate error code otherwise
+ *//*********************************************************************/
+static OSC_ERR QueryApp()
+{
+	struct IPC_OPTIONS options;
+	struct IPC_STATE_REPLY reply;
+	OSC_ERR err;
+
+	err = CollectOptions(&options);
+	if (err != SUCCESS)
+	{
+		return err;
+	}
+	err = IpcRequest(SET_OPTIONS_GET_STATE, &options, sizeof(options), &reply, sizeof(reply));
+	if (err == -ENEGATIVE_ACKNOWLEDGE && options.setFlags != 0)
+	{
+		OscLog(DEBUG, "CGI: Options rejected by the application!\n");
+		options.setFlags = 0;
+		err = IpcRequest(SET_OPTIONS_GET_STATE, &options, sizeof(options), &reply, sizeof(reply));
 	}
+	if (err != SUCCESS)
+	{
+		/* This request is defined in all states, and thus must succeed. */
+		OscLog(ERROR, "CGI: Error querying application! (%d)\n", err);
+		return err;
+	}
+	cgi.appState = reply.state;
+	cgi.stageTimes = reply.stageTimes;
 
+	switch(cgi.appState.enAppMode)
+	{
+	case APP_OFF:
+		/* Algorithm is off, nothing else to do. */
+		break;
+	case APP_CAPTURE_ON:
+		/* the frame of the state, if it is not overwritten already */
+		if (cgi.appState.nImageFrame == 0)
+			break;
+		if (WriteImage(cgi.appState.nImageFrame) == SUCCESS)
+			break;
+		return WriteNewestImage();
+	default:
+		OscLog(ERROR, "%s: Invalid application mode (%d)!\n", __func__, cgi.appState.enAppMode);
+		break;
+	}
 	return SUCCESS;
 }
 
@@ -381,12 +677,19 @@ static OSC_ERR SetOptions()
  *//*********************************************************************/
 static void FormCGIResponse()
 {
+	/* the names of the stages in the response (enum EnStage) */
+	static const char * const stageNames[NR_STAGES] = {
+		"CaptureWait", "SensorImage", "ChangeDetection", "Morphology",
+		"Labeling", "ColorAnalysis", "Overlay", "Publish"
+	};
 	struct APPLICATION_STATE  *pAppState = &cgi.appState;
+	int i;
 
 	/* Header */
 	printf("Content-type: text/plain\n\n" );
 
 	printf("imgTS: %u\n", (unsigned int)pAppState->imageTimeStamp);
+	printf("ImageFrame: %u\n", (unsigned int)pAppState->nImageFrame);
 	printf("exposureTime: %d\n", pAppState->nExposureTime);
 	printf("Threshold: %d\n", pAppState->nThreshold);
 	printf("Stepcounter: %d\n", pAppState->nStepCounter);
@@ -394,6 +697,42 @@ static void FormCGIResponse()
 	printf("height: %d\n", OSC_CAM_MAX_IMAGE_HEIGHT);
 	printf("ImageType: %u\n", pAppState->nImageType);
 	printf("AddInfo: %d\n", pAppState->nAddInfo);
+	printf("MorphOp: %d\n", pAppState->morph.op);
+	printf("MorphWidth: %d\n", pAppState->morph.width);
+	printf("MorphHeight: %d\n", pAppState->morph.height);
+	printf("OtsuSampleStep: %d\n", pAppState->nOtsuSampleStep);
+	printf("FrameBytesRead: %u\n", (unsigned int)pAppState->nFrameBytesRead);
+	printf("FrameBytesWritten: %u\n", (unsigned int)pAppState->nFrameBytesWritten);
+	printf("WorkerUtilization:");
+	for (i = 0; i < pAppState->nWorkers && i < MAX_NUM_WORKERS; i++)
+		printf(" %u%%", (unsigned int)pAppState->workerUtilization[i]);
+	printf("\n");
+	printf("TilesStolen: %u\n", (unsigned int)pAppState->nTilesStolen);
+	/* one letter per frame buffer: Free, Capturing, Ready, Processing,
+	 * pUblished */
+	printf("FrameBuffers: ");
+	for (i = 0; i < pAppState->nFrameBuffers && i < MAX_FRAME_BUFFERS; i++)
+		putchar(pAppState->frameBufferState[i] <= FRAME_BUFFER_PUBLISHED ?
+				"FCRPU"[pAppState->frameBufferState[i]] : '?');
+	printf("\n");
+	printf("FramesCaptured: %u\n", (unsigned int)pAppState->nFramesCaptured);
+	printf("CameraWaits: %u\n", (unsigned int)pAppState->nCameraWaits);
+	printf("CameraWaitMs: %u\n", (unsigned int)pAppState->cameraWaitMs);
+	printf("CpuLoad: %u\n", (unsigned int)pAppState->cpuLoad);
+	printf("LoopIdle: %u\n", (unsigned int)pAppState->loopIdle);
+	printf("LoopWakeups: %u\n", (unsigned int)pAppState->loopWakeups);
+	printf("IpcLatencyUs: %u\n", (unsigned int)pAppState->ipcLatencyUs);
+	printf("IpcLatencyMaxUs: %u\n", (unsigned int)pAppState->ipcLatencyMaxUs);
+	/* p50 / p95 / p99 / max in us and the number of samples per stage */
+	for (i = 0; i < NR_STAGES; i++)
+	{
+		const struct STAGE_HISTOGRAM *pHist = &cgi.stageTimes.stages[i];
+
+		printf("Stage%s: %u / %u / %u / %u (%u)\n", stageNames[i],
+				(unsigned int)pHist->p50Us, (unsigned int)pHist->p95Us,
+				(unsigned int)pHist->p99Us, (unsigned int)pHist->maxUs,
+				(unsigned int)pHist->nSamples);
+	}
 
 	fflush(stdout);
 }
@@ -404,6 +743,7 @@ OscFunction(mainFunction)
 
 	/* Initialize */
 	memset(&cgi, 0, sizeof(struct CGI_TEMPLATE));
+	cgi.ipcSocket = -1;
 
 	/* First, check if the algorithm is even running and ready for IPC
 	 * by looking if its socket exists.*/
@@ -418,35 +758,41 @@ OscFunction(mainFunction)
 
 	/******* Create the framework **********/
 	OscCall(OscCreate,
-		&OscModule_log,
-		&OscModule_ipc);
+		&OscModule_log);
 
 	OscLogSetConsoleLogLevel(CRITICAL);
 	OscLogSetFileLogLevel(DEBUG);
 
-	OscCall( OscIpcRegisterChannel, &cgi.ipcChan, USER_INTERFACE_SOCKET_PATH, 0);
+	OscCall( IpcConnect);
+	OscCall( MapImageRing);
 
 	OscCall( CGIParseArguments);
 
-	/* The algorithm negative acknowledges if it cannot supply
-	 * the requested data, i.e. it changed state during the
-	 * process of getting the data.
-	 * Try again until we succeed. */
-	do
+	/* Instead of polling for new frames, the web interface sends the
+	 * frame it shows and gets the state once there is a newer one. */
+	if (cgi.args.bImageFrame_supplied)
 	{
-		do
-		{
-			err = QueryApp();
-		} while (err == -ENEGATIVE_ACKNOWLEDGE);
+		OscCall( WaitNewFrame);
+	}
 
-		OscAssert_m( err == SUCCESS, "Error querying algorithm!");
-		err = SetOptions();
+	/* The frames may be overwritten by the algorithm faster than
+	 * they are read. Try again until we succeed. */
+	do
+	{
+		err = QueryApp();
 	} while (err == -ENEGATIVE_ACKNOWLEDGE);
+
+	OscAssert_m( err == SUCCESS, "Error querying algorithm!");
 	FormCGIResponse();
 
+	close(cgi.ipcSocket);
 	OscDestroy();
 
 OscFunctionCatch()
+	if (cgi.ipcSocket >= 0)
+	{
+		close(cgi.ipcSocket);
+	}
 	OscDestroy();
 	OscLog(INFO, "Quit application abnormally!\n");
 OscFunctionEnd()
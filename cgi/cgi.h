@@ -71,14 +71,45 @@ struct ARGUMENT_DATA
 	/*! @brief Says whether the argument nAddInfo has been
 	 * supplied or not. */
 	bool bAddInfo_supplied;
+	/*! @brief morphological operation (enum EnMorphOp).*/
+	int nMorphOp;
+	/*! @brief Says whether the argument MorphOp has been
+	 * supplied or not. */
+	bool bMorphOp_supplied;
+	/*! @brief width of the morphology rectangle.*/
+	int nMorphWidth;
+	/*! @brief Says whether the argument MorphWidth has been
+	 * supplied or not. */
+	bool bMorphWidth_supplied;
+	/*! @brief height of the morphology rectangle.*/
+	int nMorphHeight;
+	/*! @brief Says whether the argument MorphHeight has been
+	 * supplied or not. */
+	bool bMorphHeight_supplied;
+	/*! @brief foreground color classes as "cb,cr,radius,color;..." */
+	char strColorClasses[MAX_ARGUMENT_STRING_LEN];
+	/*! @brief Says whether the argument ColorClasses has been
+	 * supplied or not. */
+	bool bColorClasses_supplied;
+	/*! @brief pixel step of the sampled histogram of Otsu's threshold.*/
+	int nOtsuSampleStep;
+	/*! @brief Says whether the argument OtsuSampleStep has been
+	 * supplied or not. */
+	bool bOtsuSampleStep_supplied;
+	/*! @brief the last frame shown by the web interface; the CGI waits
+	 * for another one.*/
+	int nImageFrame;
+	/*! @brief Says whether the argument ImageFrame has been
+	 * supplied or not. */
+	bool bImageFrame_supplied;
 };
 
 /*! @brief Main object structure of the CGI. Contains all 'global'
  * variables. */
 struct CGI_TEMPLATE
 {
-	/*! @brief IPC channel ID*/
-	OSC_IPC_CHAN_ID ipcChan;
+	/*! @brief The connection to the application, -1 if there is none. */
+	int ipcSocket;
 
 	/*! @brief The raw argument string as supplied by the web server. */
 	char strArgumentsRaw[MAX_ARGUMENT_STRING_LEN];
@@ -87,10 +118,13 @@ struct CGI_TEMPLATE
 
 	/*! @brief The state queried from the application. */
 	struct APPLICATION_STATE appState;
+	/*! @brief The stage latencies queried from the application. */
+	struct STAGE_TIMES stageTimes;
 	/*! @brief The GET/POST arguments of the CGI. */
 	struct ARGUMENT_DATA    args;
-	/*! @brief Temporary data buffer for the images to be saved. */
-	/* we reserve space for ADD_INFO buffer for drawing objects */
-	uint8 imgBuf[2*NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT+4];
+	/*! @brief The frames published by the application, NULL if not mapped. */
+	const struct IMAGE_RING *pImageRing;
+	/*! @brief The drawing info of the image, 0-terminated. */
+	uint8 addInfo[MAX_ADD_INFO_SIZE+1];
 };
 #endif /*CGI_TEMPLATE_H_*/
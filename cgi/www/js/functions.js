@@ -354,6 +354,13 @@ var stateControl = {
 }
 
 function updateCycle() {
+	// The frame shown; the CGI answers only once there is another one.
+	var imageFrame = 0;
+	// The state of the application last received.
+	var state = null;
+	// The options of inputValues which are set in the application.
+	var optionNames = ["ImageType", "exposureTime", "Threshold", "AddInfo", "MorphOp", "MorphWidth", "MorphHeight"];
+	
 	function offline() {
 		stateControl.pullState("offline");
 		
@@ -373,9 +380,31 @@ function updateCycle() {
 	}
 	
 	function online() {
+		var args = { ImageFrame: imageFrame };
+		
 		stateControl.pullState("online");
 		
-		exchangeState("GetImage", { }, function (data) {
+		// The options changed since the last state are set in the same
+		// exchange, all at once.
+		if (state)
+			$.each(optionNames, function (i, key) {
+				if (state[key] != inputValues[key])
+					args[key] = inputValues[key];
+			});
+		
+		exchangeState("GetImage", args, function (data) {
+			// The options the page has no value for start as the
+			// application has them.
+			if (!state)
+				$.each(optionNames, function (i, key) {
+					if (inputValues[key] == null) {
+						inputValues[key] = data[key];
+						$("input[name=" + key + "][value=" + data[key] + "]").attr("checked", "checked");
+					}
+				});
+			
+			state = data;
+			imageFrame = data.ImageFrame;
 			asynLoadImage("image.gif?" + data.imgTS, function () {
 				$(this).attr("id", "image");
 				$("#image").replaceWith(this);
@@ -394,27 +423,6 @@ function updateCycle() {
 			//	console.log(event);
 				offline();
 			});
-			
-			if (data.ImageType != inputValues.ImageType)
-				exchangeState("SetOptions", {
-					ImageType: inputValues.ImageType
-				});
-			
-			if (data.exposureTime != inputValues.exposureTime)
-				exchangeState("SetOptions", {
-					exposureTime: inputValues.exposureTime
-				});			
-			
-			if (data.Threshold != inputValues.Threshold)
-				exchangeState("SetOptions", {
-					Threshold: inputValues.Threshold
-				});
-				
-			if (data.AddInfo != inputValues.AddInfo)
-				exchangeState("SetOptions", {
-					AddInfo: inputValues.AddInfo
-				});
-			
 		}, function (request, status) {
 		//	console.log(status);
 			offline();
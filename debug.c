@@ -12,6 +12,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+/*! @brief The 8 bit image written by WrDbgImgInt16 and WrDbgImgUint16;
+ * static, so that a dump allocates nothing and takes nothing from the
+ * frame arena. */
+static uint8 DbgPix[OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT];
+
 OSC_ERR WrDbgImgInt16(const int16 *pData,  const uint16 width,  const uint16 height, const char * strPrefix, int32 seq)
 {
 	struct OSC_PICTURE pic;
@@ -21,7 +26,12 @@ OSC_ERR WrDbgImgInt16(const int16 *pData,  const uint16 width,  const uint16 hei
 	char strName[256];
 	char strTemp[16];
 	
-	pPix = (uint8*)malloc(width*height);
+	/* the image is written before the buffer is used again */
+	if ((uint32)width*height > sizeof(DbgPix))
+	{
+		return -EINVALID_PARAMETER;
+	}
+	pPix = DbgPix;
 	pic.width = width;
 	pic.height = height;
 	pic.type = OSC_PICTURE_GREYSCALE;
@@ -43,7 +53,6 @@ OSC_ERR WrDbgImgInt16(const int16 *pData,  const uint16 width,  const uint16 hei
 	}
 	err = OscBmpWrite(&pic, strName);
 	
-	free(pPix);
 	return err;
 }
 
@@ -56,7 +65,12 @@ OSC_ERR WrDbgImgUint16(const uint16 *pData, const uint16 width,  const uint16 he
 	char strName[256];
 	char strTemp[16];
 	
-	pPix = (uint8*)malloc(width*height);
+	/* the image is written before the buffer is used again */
+	if ((uint32)width*height > sizeof(DbgPix))
+	{
+		return -EINVALID_PARAMETER;
+	}
+	pPix = DbgPix;
 	pic.width = width;
 	pic.height = height;
 	pic.type = OSC_PICTURE_GREYSCALE;
@@ -78,7 +92,6 @@ OSC_ERR WrDbgImgUint16(const uint16 *pData, const uint16 width,  const uint16 he
 	}
 	err = OscBmpWrite(&pic, strName);
 	
-	free(pPix);
 	return err;
 }
 
@@ -5,8 +5,8 @@
 
 /*! @file draw.c
  * @brief Contains drawing routines; work is done in cgi.c only in case an image is
- * requested by browser; the data is transmitted by pasting it at the end of the image
- * buffer (data.ipc.req.pAddr).
+ * requested by browser; the data is published right after the image (see struct
+ * IMAGE_HEADER), at most MAX_ADD_INFO_SIZE bytes.
  */
 
 /* Definitions specific to this application. Also includes the Oscar main header file. */
@@ -14,8 +14,6 @@
 #include <string.h>
 #include <stdlib.h>
 
-#define IMG_SIZE NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT
-
 const int sizRect = sizeof(struct IMG_RECT);
 const int sizLine = sizeof(struct IMG_LINE);
 const int sizString = sizeof(struct IMG_STRING);
@@ -27,7 +25,7 @@ void DrawBoundingBox(uint16 left, uint16 bottom, uint16 right, uint16 top, bool
 	int dataSiz = data.AddBufSize;
 	struct IMG_RECT imgRect;
 
-	if(dataSiz+2+sizRect < IMG_SIZE) {//2byte for type
+	if(dataSiz+2+sizRect <= MAX_ADD_INFO_SIZE) {//2byte for type
 		uint16 oType = OBJ_RECT;
 		memcpy(pData+dataSiz, &oType, sizeof(uint16));
 		dataSiz += sizeof(uint16);
@@ -50,7 +48,7 @@ void DrawLine(uint16 x1, uint16 y1, uint16 x2, uint16 y2, uint8 color)
 	int dataSiz = data.AddBufSize;
 	struct IMG_LINE imgLine;
 
-	if(dataSiz+2+sizLine < IMG_SIZE) {//2byte for type
+	if(dataSiz+2+sizLine <= MAX_ADD_INFO_SIZE) {//2byte for type
 		uint16 oType = OBJ_LINE;
 		memcpy(pData+dataSiz, &oType, sizeof(uint16));
 		dataSiz += sizeof(uint16);
@@ -72,7 +70,7 @@ void DrawString(uint16 xPos, uint16 yPos, uint16 len, uint16 font, uint8 color,
 	int dataSiz = data.AddBufSize;
 	struct IMG_STRING imgString;
 
-	if(dataSiz+2+sizString+len < IMG_SIZE) {//2byte for type
+	if(dataSiz+2+sizString+len <= MAX_ADD_INFO_SIZE) {//2byte for type
 		uint16 oType = OBJ_STRING;
 		memcpy(pData+dataSiz, &oType, sizeof(uint16));
 		dataSiz += sizeof(uint16);
@@ -0,0 +1,124 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file framepool.c
+ * @brief The frame buffers of the camera and their state.
+ */
+
+#include "framepool.h"
+#include <stdlib.h>
+
+static struct
+{
+	int nBuffers;
+	uint8 *pBuffers[MAX_FRAME_BUFFERS];
+	/*! @brief enum EnFrameBufferState of each buffer; written by the
+	 * owning stage, read by anyone. */
+	uint8 states[MAX_FRAME_BUFFERS];
+	struct FRAME_POOL_STATS stats;
+} Pool;
+
+OSC_ERR FramePoolCreate(int nBuffers, uint32 size)
+{
+	uint8 multiBufferIds[MAX_FRAME_BUFFERS];
+	OSC_ERR err;
+	int i;
+
+	if (nBuffers < 2 || nBuffers > MAX_FRAME_BUFFERS)
+	{
+		OscLog(ERROR, "%s: Invalid number of frame buffers (%d)!\n", __func__, nBuffers);
+		return -EINVALID_PARAMETER;
+	}
+	/* Set up the frame buffers for maximum image size. Cached memory.
+	 * Register the buffers as multi-buffer for the camera, the handles
+	 * are the IDs */
+	for (i = 0; i < nBuffers; i++)
+	{
+		Pool.pBuffers[i] = malloc(size);
+		if (Pool.pBuffers[i] == NULL)
+		{
+			OscLog(ERROR, "%s: Unable to allocate frame buffer %d!\n", __func__, i);
+			FramePoolDestroy();
+			return -EOUT_OF_MEMORY;
+		}
+		Pool.nBuffers++;
+		Pool.states[i] = FRAME_BUFFER_FREE;
+		multiBufferIds[i] = i;
+		err = OscCamSetFrameBuffer(i, size, Pool.pBuffers[i], TRUE);
+		if (err != SUCCESS)
+		{
+			FramePoolDestroy();
+			return err;
+		}
+	}
+	err = OscCamCreateMultiBuffer(nBuffers, multiBufferIds);
+	if (err != SUCCESS)
+	{
+		FramePoolDestroy();
+	}
+	return err;
+}
+
+void FramePoolDestroy(void)
+{
+	int i;
+
+	for (i = 0; i < Pool.nBuffers; i++)
+	{
+		free(Pool.pBuffers[i]);
+		Pool.pBuffers[i] = NULL;
+	}
+	Pool.nBuffers = 0;
+}
+
+int FramePoolDepth(void)
+{
+	return Pool.nBuffers;
+}
+
+uint8 *FramePoolBuffer(int handle)
+{
+	return Pool.pBuffers[handle];
+}
+
+int FramePoolHandle(const uint8 *pImg)
+{
+	int i;
+
+	for (i = 0; i < Pool.nBuffers; i++)
+	{
+		if (pImg == Pool.pBuffers[i])
+			return i;
+	}
+	return -1;
+}
+
+void FramePoolSetState(int handle, enum EnFrameBufferState state)
+{
+	__atomic_store_n(&Pool.states[handle], state, __ATOMIC_RELAXED);
+}
+
+enum EnFrameBufferState FramePoolGetState(int handle)
+{
+	return __atomic_load_n(&Pool.states[handle], __ATOMIC_RELAXED);
+}
+
+void FramePoolCountCapture(bool bWaited, uint32 waitMs)
+{
+	/* only the acquire stage writes the counters */
+	__atomic_store_n(&Pool.stats.nCaptured, Pool.stats.nCaptured + 1, __ATOMIC_RELAXED);
+	if (bWaited)
+	{
+		__atomic_store_n(&Pool.stats.nWaits, Pool.stats.nWaits + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&Pool.stats.waitMs, Pool.stats.waitMs + waitMs, __ATOMIC_RELAXED);
+	}
+}
+
+void FramePoolGetStats(struct FRAME_POOL_STATS *pStats)
+{
+	pStats->nCaptured = __atomic_load_n(&Pool.stats.nCaptured, __ATOMIC_RELAXED);
+	pStats->nWaits = __atomic_load_n(&Pool.stats.nWaits, __ATOMIC_RELAXED);
+	pStats->waitMs = __atomic_load_n(&Pool.stats.waitMs, __ATOMIC_RELAXED);
+}
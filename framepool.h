@@ -0,0 +1,104 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file framepool.h
+ * @brief The frame buffers of the camera, their state and how often the
+ * camera had to wait for one.
+ *
+ * The number of buffers is chosen at startup: more buffers absorb jitter
+ * of the processing, fewer cut the latency from capture to result. A
+ * buffer is identified by its handle, which is also its ID in the camera
+ * multi-buffer, so the camera fills the buffers in the order of their
+ * handles.
+ */
+#ifndef FRAMEPOOL_H_
+#define FRAMEPOOL_H_
+
+#include "oscar.h"
+#include "template_ipc.h"
+
+/*! @brief Counters of the frame buffer pool. */
+struct FRAME_POOL_STATS
+{
+	/*! @brief Number of frames captured. */
+	uint32 nCaptured;
+	/*! @brief How often the camera had to wait for a free buffer. */
+	uint32 nWaits;
+	/*! @brief Total time waited (ms). */
+	uint32 waitMs;
+};
+
+/*********************************************************************//*!
+ * @brief Allocate the frame buffers and register them as multi-buffer
+ * with the camera.
+ *
+ * @param nBuffers Number of buffers (2 ... MAX_FRAME_BUFFERS).
+ * @param size Size of a buffer (bytes).
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR FramePoolCreate(int nBuffers, uint32 size);
+
+/*********************************************************************//*!
+ * @brief Release the frame buffers.
+ *//*********************************************************************/
+void FramePoolDestroy(void);
+
+/*********************************************************************//*!
+ * @brief The number of frame buffers.
+ *
+ * @return The number.
+ *//*********************************************************************/
+int FramePoolDepth(void);
+
+/*********************************************************************//*!
+ * @brief The memory of a frame buffer.
+ *
+ * @param handle The frame buffer.
+ * @return The memory.
+ *//*********************************************************************/
+uint8 *FramePoolBuffer(int handle);
+
+/*********************************************************************//*!
+ * @brief The frame buffer an image was captured to.
+ *
+ * @param pImg The image as returned by the camera.
+ * @return The handle or -1 if the image is not in a frame buffer.
+ *//*********************************************************************/
+int FramePoolHandle(const uint8 *pImg);
+
+/*********************************************************************//*!
+ * @brief Record the state of a frame buffer; only the stage owning the
+ * buffer sets it.
+ *
+ * @param handle The frame buffer.
+ * @param state The new state.
+ *//*********************************************************************/
+void FramePoolSetState(int handle, enum EnFrameBufferState state);
+
+/*********************************************************************//*!
+ * @brief The state of a frame buffer; may be read by any thread.
+ *
+ * @param handle The frame buffer.
+ * @return The state.
+ *//*********************************************************************/
+enum EnFrameBufferState FramePoolGetState(int handle);
+
+/*********************************************************************//*!
+ * @brief Count a captured frame and the time the camera waited for its
+ * buffer (acquire stage only).
+ *
+ * @param bWaited Whether the buffer was not free right away.
+ * @param waitMs The time waited.
+ *//*********************************************************************/
+void FramePoolCountCapture(bool bWaited, uint32 waitMs);
+
+/*********************************************************************//*!
+ * @brief The counters; may be read by any thread.
+ *
+ * @param pStats The counters.
+ *//*********************************************************************/
+void FramePoolGetStats(struct FRAME_POOL_STATS *pStats);
+
+#endif /*FRAMEPOOL_H_*/
@@ -0,0 +1,83 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file imagering.c
+ * @brief Seqlocked ring of processed frames in shared memory.
+ */
+
+#include "imagering.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*! @brief The mapped ring, NULL if there is none. */
+static struct IMAGE_RING *pRing;
+
+OSC_ERR ImageRingCreate(void)
+{
+	void *p;
+	const int fd = shm_open(IMAGE_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+
+	if (fd < 0)
+	{
+		OscLog(ERROR, "%s: Unable to create %s (%d)!\n", __func__, IMAGE_SHM_NAME, errno);
+		return -EDEVICE;
+	}
+	/* readable by the web server whatever the umask; fresh pages are zero,
+	 * so nothing is published yet */
+	if (fchmod(fd, 0644) != 0 || ftruncate(fd, sizeof(struct IMAGE_RING)) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to size %s (%d)!\n", __func__, IMAGE_SHM_NAME, errno);
+		close(fd);
+		shm_unlink(IMAGE_SHM_NAME);
+		return -EDEVICE;
+	}
+	p = mmap(NULL, sizeof(struct IMAGE_RING), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		OscLog(ERROR, "%s: Unable to map %s (%d)!\n", __func__, IMAGE_SHM_NAME, errno);
+		shm_unlink(IMAGE_SHM_NAME);
+		return -EDEVICE;
+	}
+	pRing = p;
+	return SUCCESS;
+}
+
+void ImageRingDestroy(void)
+{
+	if (pRing == NULL)
+		return;
+	munmap(pRing, sizeof(struct IMAGE_RING));
+	shm_unlink(IMAGE_SHM_NAME);
+	pRing = NULL;
+}
+
+uint32 ImageRingPublish(const struct IMAGE_HEADER *pHeader, const uint8 *pImage, const uint8 *pAddInfo)
+{
+	const uint32 nPublished = pRing->nPublished;
+	struct IMAGE_SLOT *pSlot = &pRing->slots[nPublished % NR_IMAGE_SLOTS];
+	const uint32 seq = pSlot->seq;
+	const uint32 imageSize = (uint32)pHeader->stride * pHeader->height;
+
+	/* odd while written; the data must not be written before */
+	__atomic_store_n(&pSlot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	pSlot->header = *pHeader;
+	if (pSlot->header.addInfoSize > sizeof(pSlot->data) - imageSize)
+	{
+		pSlot->header.addInfoSize = 0;
+	}
+	memcpy(pSlot->data, pImage, imageSize);
+	memcpy(pSlot->data + imageSize, pAddInfo, pSlot->header.addInfoSize);
+	/* the data is complete before the slot is even again and before it
+	 * is the newest */
+	__atomic_store_n(&pSlot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&pRing->nPublished, nPublished + 1, __ATOMIC_RELEASE);
+	return nPublished + 1;
+}
@@ -0,0 +1,44 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file imagering.h
+ * @brief The processed frames published in POSIX shared memory (struct
+ * IMAGE_RING), where the web interface reads them without a copy through
+ * the socket.
+ *
+ * The process stage is the only writer and never waits for a reader: it
+ * overwrites the oldest slot, and a reader which was too slow notices it
+ * from the sequence number of the slot and reads again.
+ */
+#ifndef IMAGERING_H_
+#define IMAGERING_H_
+
+#include "oscar.h"
+#include "template_ipc.h"
+
+/*********************************************************************//*!
+ * @brief Create the shared memory object IMAGE_SHM_NAME and map it.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR ImageRingCreate(void);
+
+/*********************************************************************//*!
+ * @brief Unmap and remove the shared memory object.
+ *//*********************************************************************/
+void ImageRingDestroy(void);
+
+/*********************************************************************//*!
+ * @brief Publish a frame in the oldest slot.
+ *
+ * @param pHeader The frame: its geometry, the size of the drawing info,
+ * the image type, the step counter and the time stamp.
+ * @param pImage The image (pHeader->stride*pHeader->height bytes).
+ * @param pAddInfo The drawing info (pHeader->addInfoSize bytes).
+ * @return The frame published, counted as IMAGE_RING.nPublished.
+ *//*********************************************************************/
+uint32 ImageRingPublish(const struct IMAGE_HEADER *pHeader, const uint8 *pImage, const uint8 *pAddInfo);
+
+#endif /*IMAGERING_H_*/
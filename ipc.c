@@ -9,76 +9,471 @@
 
 #include "template.h"
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-OSC_ERR CheckIpcRequests(uint32 *pParamId)
+/*! @brief A connection of the web interface and its request slot. */
+struct IPC_CLIENT
 {
-	OSC_ERR err;
-	struct IPC_DATA *pIpc = &data.ipc;
-	struct OSC_IPC_REQUEST *pReq = &pIpc->req;
-	
-	if (pIpc->enReqState != REQ_STATE_IDLE)
+	/*! @brief The connection, -1 if the slot is free. */
+	int fd;
+	/*! @brief Bytes of the request read or of the reply written so far,
+	 * header included. */
+	uint32 nDone;
+	/*! @brief Whether a whole request was read and waits to be handled. */
+	bool bRequestRead;
+	/*! @brief Whether the reply is being written. */
+	bool bReplying;
+	/*! @brief Whether the request waits for the next frame. */
+	bool bWaitingFrame;
+	struct IPC_REQUEST_HEADER reqHeader;
+	struct IPC_REPLY_HEADER replyHeader;
+	/*! @brief When the request was read (ns). */
+	uint64_t readNs;
+	/*! @brief The value of the request and then of its reply
+	 * (IPC_MAX_VALUE_SIZE bytes). */
+	uint8 *pValue;
+};
+
+/*! @brief The socket of the web interface and the request slots of its
+ * connections. */
+static struct
+{
+	int listenFd;
+	REACTOR_HANDLER handler;
+	void *pContext;
+	/*! @brief Number of request slots. */
+	int nClients;
+	struct IPC_CLIENT clients[IPC_MAX_CLIENTS];
+	/*! @brief The slot of the request being handled, NULL if none. */
+	struct IPC_CLIENT *pCurrent;
+	/*! @brief The slot looked at first for the next request, so that the
+	 * connections are served in turn. */
+	int iNext;
+	struct IPC_STATS stats;
+} Ipc = { .listenFd = -1 };
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*********************************************************************//*!
+ * @brief Read or write a message (a header followed by the value) as far
+ * as the connection allows, continuing at pClient->nDone.
+ *
+ * @param pClient The connection.
+ * @param bWrite Whether to write.
+ * @param pHeader The header.
+ * @param headerSize Size of the header.
+ * @param valueSize Size of the value.
+ * @return 1 if the message is complete, 0 if the connection would block,
+ * -1 if it was closed or failed.
+ *//*********************************************************************/
+static int Transfer(struct IPC_CLIENT *pClient, bool bWrite, void *pHeader, uint32 headerSize, uint32 valueSize)
+{
+	while (pClient->nDone < headerSize + valueSize)
 	{
-		/* This means we still have an unacknowledged request from
-		 * last time. Proceed with the acknowledgement instead of
-		 * already getting new ones.*/
-		return -ENO_MSG_AVAIL;
+		uint8 *p;
+		uint32 n;
+		ssize_t result;
+
+		if (pClient->nDone < headerSize)
+		{
+			p = (uint8*)pHeader + pClient->nDone;
+			n = headerSize - pClient->nDone;
+		}
+		else
+		{
+			p = pClient->pValue + pClient->nDone - headerSize;
+			n = headerSize + valueSize - pClient->nDone;
+		}
+		if (bWrite)
+			result = send(pClient->fd, p, n, MSG_NOSIGNAL);
+		else
+			result = recv(pClient->fd, p, n, 0);
+
+		if (result > 0)
+			pClient->nDone += result;
+		else if (result < 0 && errno == EINTR)
+			continue;
+		else if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		else
+			return -1;
 	}
-	
-	/* Get the next request. */
-	err = OscIpcGetRequest(pIpc->ipcChan, pReq);
-	if (err == SUCCESS)
+	return 1;
+}
+
+/*! @brief The slot of a connection, a free slot for -1; NULL if there is
+ * none. */
+static struct IPC_CLIENT *FindClient(int fd)
+{
+	int i;
+
+	for (i = 0; i < Ipc.nClients; i++)
 	{
-		/* We have a request. */
-		
-		/* In case of success simply return the parameter ID of the requested parameter. */
-		*pParamId = pReq->paramID;
+		if (Ipc.clients[i].fd == fd)
+			return &Ipc.clients[i];
 	}
-	else
+	return NULL;
+}
+
+/*! @brief Close a connection and free its slot for a waiting one; a
+ * request or reply of it is dropped. */
+static void CloseClient(struct IPC_CLIENT *pClient)
+{
+	ReactorRemove(pClient->fd);
+	close(pClient->fd);
+	pClient->fd = -1;
+	pClient->nDone = 0;
+	pClient->bRequestRead = FALSE;
+	pClient->bReplying = FALSE;
+	pClient->bWaitingFrame = FALSE;
+	ReactorModify(Ipc.listenFd, EPOLLIN);
+}
+
+static OSC_ERR OnSocketEvent(int fd, uint32 events, void *pContext);
+
+/*! @brief Accept the waiting connections into the free slots. */
+static void AcceptConnections(void)
+{
+	struct IPC_CLIENT *pClient;
+
+	while ((pClient = FindClient(-1)) != NULL)
 	{
-		/* Getting request not successful => analyze why. */
-		if (likely(err == -ENO_MSG_AVAIL))
+		const int fd = accept(Ipc.listenFd, NULL, NULL);
+
+		if (fd < 0)
+			return;
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (ReactorAdd(fd, EPOLLIN, OnSocketEvent, NULL) != SUCCESS)
 		{
-			/* Simply no request available. */
+			close(fd);
+			return;
 		}
-		else
+		pClient->fd = fd;
+		pClient->nDone = 0;
+	}
+	/* all slots taken, the other connections wait in the backlog */
+	ReactorModify(Ipc.listenFd, 0);
+}
+
+/*! @brief Read the request of a connection as far as it has arrived. */
+static void ReadRequest(struct IPC_CLIENT *pClient)
+{
+	struct IPC_REQUEST_HEADER *pHeader = &pClient->reqHeader;
+	int result;
+
+	/* Read the header and then the value of a set request. */
+	result = Transfer(pClient, FALSE, pHeader, sizeof(*pHeader), 0);
+	if (result == 1 && pHeader->length > IPC_MAX_VALUE_SIZE)
+	{
+		OscLog(ERROR, "%s: Request too large (%u bytes)!\n", __func__, pHeader->length);
+		result = -1;
+	}
+	if (result == 1 && pHeader->bSet)
+	{
+		result = Transfer(pClient, FALSE, pHeader, sizeof(*pHeader), pHeader->length);
+	}
+	if (result < 0)
+	{
+		/* The web interface is gone or out of step. */
+		CloseClient(pClient);
+	}
+	else if (result == 1)
+	{
+		/* Nothing is read from the connection until it is answered. */
+		pClient->nDone = 0;
+		pClient->readNs = NowNs();
+		pClient->bRequestRead = TRUE;
+		ReactorModify(pClient->fd, 0);
+	}
+}
+
+/*! @brief Write the reply of a connection as far as it takes it. */
+static OSC_ERR SendReply(struct IPC_CLIENT *pClient)
+{
+	struct IPC_REPLY_HEADER *pHeader = &pClient->replyHeader;
+	const int result = Transfer(pClient, TRUE, pHeader, sizeof(*pHeader), pHeader->length);
+	uint32 latencyNs;
+
+	if (result < 0)
+	{
+		CloseClient(pClient);
+		return SUCCESS;
+	}
+	else if (result == 0)
+	{
+		/* Not really an error, the rest follows when the connection
+		 * takes it. */
+		return ReactorModify(pClient->fd, EPOLLOUT);
+	}
+
+	/* Reply sent. Now the connection may send its next request. */
+	latencyNs = NowNs() - pClient->readNs;
+	Ipc.stats.nRequests++;
+	Ipc.stats.latencyNs += latencyNs;
+	if (latencyNs > Ipc.stats.maxLatencyNs)
+	{
+		Ipc.stats.maxLatencyNs = latencyNs;
+	}
+	pClient->bReplying = FALSE;
+	pClient->nDone = 0;
+	return ReactorModify(pClient->fd, EPOLLIN);
+}
+
+/*! @brief Reactor handler of the socket and the connections. */
+static OSC_ERR OnSocketEvent(int fd, uint32 events, void *pContext)
+{
+	struct IPC_CLIENT *pClient;
+
+	if (fd == Ipc.listenFd)
+	{
+		AcceptConnections();
+		return SUCCESS;
+	}
+	pClient = FindClient(fd);
+	if (pClient == NULL)
+	{
+		/* closed meanwhile */
+		return SUCCESS;
+	}
+	/* Hang-ups are reported whatever the connection waits for; while its
+	 * request is answered nothing is read that would notice it. */
+	if ((pClient->bRequestRead || pClient->bReplying || pClient->bWaitingFrame) &&
+			(events & (EPOLLHUP | EPOLLERR)))
+	{
+		CloseClient(pClient);
+		return SUCCESS;
+	}
+	if (pClient->bWaitingFrame)
+	{
+		return SUCCESS;
+	}
+	if (pClient->bReplying)
+	{
+		return SendReply(pClient);
+	}
+	ReadRequest(pClient);
+	if (pClient->fd == fd && pClient->bRequestRead)
+	{
+		return Ipc.handler(fd, events, Ipc.pContext);
+	}
+	return SUCCESS;
+}
+
+OSC_ERR IpcServerCreate(const char *strPath, int nClients, REACTOR_HANDLER handler, void *pContext)
+{
+	struct sockaddr_un addr;
+	OSC_ERR err;
+	int i;
+
+	if (strlen(strPath) >= sizeof(addr.sun_path))
+	{
+		OscLog(ERROR, "%s: Socket path too long!\n", __func__);
+		return -EINVALID_PARAMETER;
+	}
+	if (nClients < 1 || nClients > IPC_MAX_CLIENTS)
+	{
+		OscLog(ERROR, "%s: Between 1 and %d clients, not %d!\n", __func__, IPC_MAX_CLIENTS, nClients);
+		return -EINVALID_PARAMETER;
+	}
+	Ipc.handler = handler;
+	Ipc.pContext = pContext;
+	Ipc.nClients = nClients;
+	Ipc.pCurrent = NULL;
+	Ipc.iNext = 0;
+	for (i = 0; i < nClients; i++)
+	{
+		Ipc.clients[i].fd = -1;
+		Ipc.clients[i].bRequestRead = FALSE;
+		Ipc.clients[i].bReplying = FALSE;
+		Ipc.clients[i].bWaitingFrame = FALSE;
+		/* large enough to be mapped, so that a slot takes memory only
+		 * for the replies its connections ask for */
+		Ipc.clients[i].pValue = malloc(IPC_MAX_VALUE_SIZE);
+		if (Ipc.clients[i].pValue == NULL)
 		{
-			OscLog(ERROR, "%s: Error getting IPC request! (%d)\n", __func__, err);
+			OscLog(ERROR, "%s: Unable to allocate the request slots!\n", __func__);
+			IpcServerDestroy();
+			return -EOUT_OF_MEMORY;
 		}
 	}
+	Ipc.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (Ipc.listenFd < 0)
+	{
+		OscLog(ERROR, "%s: Unable to create the socket (%d)!\n", __func__, errno);
+		IpcServerDestroy();
+		return -EDEVICE;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, strPath);
+	/* a socket left behind by an earlier run */
+	unlink(strPath);
+	if (bind(Ipc.listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+			listen(Ipc.listenFd, IPC_MAX_CLIENTS) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to bind the socket to %s (%d)!\n", __func__, strPath, errno);
+		IpcServerDestroy();
+		return -EDEVICE;
+	}
+	err = ReactorAdd(Ipc.listenFd, EPOLLIN, OnSocketEvent, NULL);
+	if (err != SUCCESS)
+	{
+		IpcServerDestroy();
+	}
 	return err;
 }
 
+void IpcServerDestroy(void)
+{
+	struct sockaddr_un addr;
+	socklen_t addrLen = sizeof(addr);
+	int i;
+
+	for (i = 0; i < Ipc.nClients; i++)
+	{
+		if (Ipc.clients[i].fd >= 0)
+		{
+			ReactorRemove(Ipc.clients[i].fd);
+			close(Ipc.clients[i].fd);
+			Ipc.clients[i].fd = -1;
+		}
+		free(Ipc.clients[i].pValue);
+		Ipc.clients[i].pValue = NULL;
+	}
+	Ipc.nClients = 0;
+	Ipc.pCurrent = NULL;
+	if (Ipc.listenFd >= 0)
+	{
+		ReactorRemove(Ipc.listenFd);
+		if (getsockname(Ipc.listenFd, (struct sockaddr*)&addr, &addrLen) == 0 && addr.sun_path[0] != 0)
+		{
+			unlink(addr.sun_path);
+		}
+		close(Ipc.listenFd);
+		Ipc.listenFd = -1;
+	}
+}
+
+void IpcTakeStats(struct IPC_STATS *pStats)
+{
+	*pStats = Ipc.stats;
+	memset(&Ipc.stats, 0, sizeof(Ipc.stats));
+}
+
+OSC_ERR CheckIpcRequests(uint32 *pParamId)
+{
+	struct IPC_REQUEST *pReq = &data.ipc.req;
+	int i;
+
+	if (Ipc.pCurrent != NULL)
+	{
+		/* This means we still have an unacknowledged request. Proceed
+		 * with the acknowledgement instead of already getting new ones.*/
+		return -ENO_MSG_AVAIL;
+	}
+
+	/* The connections with a request in turn, starting after the one
+	 * served last. */
+	for (i = 0; i < Ipc.nClients; i++)
+	{
+		struct IPC_CLIENT *pClient = &Ipc.clients[(Ipc.iNext + i) % Ipc.nClients];
+
+		if (pClient->fd >= 0 && pClient->bRequestRead)
+		{
+			/* We have a request. In case of success simply return the
+			 * parameter ID of the requested parameter. */
+			Ipc.iNext = (pClient - Ipc.clients + 1) % Ipc.nClients;
+			Ipc.pCurrent = pClient;
+			pClient->bRequestRead = FALSE;
+			pReq->paramID = pClient->reqHeader.paramID;
+			pReq->pAddr = pClient->pValue;
+			pReq->length = pClient->reqHeader.length;
+			pReq->replyLength = pClient->reqHeader.bSet ? 0 : pClient->reqHeader.length;
+			*pParamId = pReq->paramID;
+			return SUCCESS;
+		}
+	}
+	/* Simply no (complete) request available. */
+	return -ENO_MSG_AVAIL;
+}
+
 OSC_ERR AckIpcRequests()
 {
 	struct IPC_DATA *pIpc = &data.ipc;
-	struct OSC_IPC_REQUEST *pReq = &pIpc->req;
-	OSC_ERR err;
-	bool bSuccess;
-	
-	if (pIpc->enReqState == REQ_STATE_IDLE)
+	struct IPC_CLIENT *pClient = Ipc.pCurrent;
+	struct IPC_REPLY_HEADER *pHeader;
+
+	if (pClient == NULL)
 	{
 		/* Nothing to acknowledge. */
 		return SUCCESS;
 	}
-	else if (pIpc->enReqState == REQ_STATE_NACK_PENDING)
+	pHeader = &pClient->replyHeader;
+	Ipc.pCurrent = NULL;
+	if (pIpc->enReqState == REQ_STATE_FRAME_PENDING)
 	{
-		bSuccess = FALSE;
+		/* Answered by IpcNotifyFrame; the connection is only watched for
+		 * a hang-up meanwhile. */
+		pIpc->enReqState = REQ_STATE_IDLE;
+		pClient->bWaitingFrame = TRUE;
+		return SUCCESS;
 	}
-	else
+	if (pIpc->enReqState == REQ_STATE_ACK_PENDING)
 	{
-		bSuccess = TRUE;
+		pHeader->err = SUCCESS;
+		pHeader->length = pIpc->req.replyLength;
 	}
-	
-	err = OscIpcAckRequest(pIpc->ipcChan, pReq, bSuccess);
-	if (err == SUCCESS)
+	else
 	{
-		/* Ack sent successfully. Now we're ready for the next request.*/
-		pIpc->enReqState = REQ_STATE_IDLE;
+		/* negative acknowledged or not handled at all */
+		pHeader->err = -ENEGATIVE_ACKNOWLEDGE;
+		pHeader->length = 0;
 	}
-	else if (err == -ETRY_AGAIN)
+	pIpc->enReqState = REQ_STATE_IDLE;
+
+	/* The reply is held in the slot until the connection took it, the
+	 * next request may be handled meanwhile. */
+	pClient->bReplying = TRUE;
+	pClient->nDone = 0;
+	return SendReply(pClient);
+}
+
+OSC_ERR IpcNotifyFrame(const void *pValue, uint32 length)
+{
+	OSC_ERR err = SUCCESS;
+	int i;
+
+	for (i = 0; i < Ipc.nClients; i++)
 	{
-		/* Not really an error, just means we have to try again later, which will happen soon enough. */
-		err = SUCCESS;
+		struct IPC_CLIENT *pClient = &Ipc.clients[i];
+		OSC_ERR errReply;
+
+		if (pClient->fd < 0 || !pClient->bWaitingFrame)
+			continue;
+		memcpy(pClient->pValue, pValue, length);
+		pClient->replyHeader.err = SUCCESS;
+		pClient->replyHeader.length = length;
+		pClient->bWaitingFrame = FALSE;
+		pClient->bReplying = TRUE;
+		pClient->nDone = 0;
+		/* the latency counted is that of the reply, not of the wait */
+		pClient->readNs = NowNs();
+		errReply = SendReply(pClient);
+		if (err == SUCCESS)
+			err = errReply;
 	}
 	return err;
 }
@@ -9,6 +9,10 @@
  */
 
 #include "template.h"
+#include "telemetry.h"
+#include "workers.h"
+#include "framepool.h"
+#include "trace.h"
 #include <string.h>
 #include <sched.h>
 #include <errno.h>
@@ -26,10 +30,43 @@ struct TEMPLATE data;
  *//*********************************************************************/
 OscFunction(static Init, const int argc, const char * argv[])
 
-	uint8 multiBufferIds[NR_FRAME_BUFFERS] = {0, 1, 2};
+	int nFrameBuffers = NR_FRAME_BUFFERS;
+	const char *strTraceFile = NULL;
 	int i;
 
 	memset(&data, 0, sizeof(struct TEMPLATE));
+	data.nIpcClients = NR_IPC_CLIENTS;
+	data.ipc.state.nOtsuSampleStep = 1;
+
+	/* -b <n>: the number of frame buffers, -c <n>: the web interface
+	 * connections served at once, -s <n>: the pixel step of the sampled
+	 * histogram of Otsu's threshold, -t <file>: record a trace */
+	for(i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+		{
+			nFrameBuffers = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+		{
+			data.nIpcClients = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc &&
+				atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= OTSU_MAX_SAMPLE_STEP)
+		{
+			data.ipc.state.nOtsuSampleStep = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+		{
+			strTraceFile = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-b <frame buffers (2 ... %d)>] [-c <web clients (1 ... %d)>] [-s <Otsu sample step (1 ... %d)>] [-t <trace file>]\n",
+					argv[0], MAX_FRAME_BUFFERS, IPC_MAX_CLIENTS, OTSU_MAX_SAMPLE_STEP);
+			return -EINVALID_PARAMETER;
+		}
+	}
 
 	/******* Create the framework **********/
 	OscCall( OscCreate,
@@ -37,7 +74,6 @@ OscFunction(static Init, const int argc, const char * argv[])
 		&OscModule_bmp,
 		&OscModule_vis,
 		&OscModule_hsm,
-		&OscModule_ipc,
 //		&OscModule_gpio,
 		&OscModule_log,
 		&OscModule_sup);
@@ -55,19 +91,30 @@ OscFunction(static Init, const int argc, const char * argv[])
 	OscCall( OscCamSetFileNameReader, data.hFileNameReader);
 #endif /* OSC_HOST or OSC_SIM */
 
-	/* Set up two frame buffers for maximum image size. Cached memory.
-	 * Register the buffers as multi-buffer for the camera */
-	for(i = 0; i < NR_FRAME_BUFFERS; i++)
+	/* Record a trace, written on SIGUSR1; before any thread is started. */
+	if(strTraceFile != NULL)
 	{
-		OscCall( OscCamSetFrameBuffer, i, NUMCOL_PLANES*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT, data.u8FrameBuffers[i], TRUE);
+		OscCall( TraceStart, strTraceFile);
 	}
-	OscCall( OscCamCreateMultiBuffer, NR_FRAME_BUFFERS, multiBufferIds);
 
-	/* Register an IPC channel to the CGI for the web interface. */
-	OscCall( OscIpcRegisterChannel, &data.ipc.ipcChan, USER_INTERFACE_SOCKET_PATH, F_IPC_SERVER | F_IPC_NONBLOCKING);
+	/* Set up the frame buffers and register them with the camera. */
+	OscCall( FramePoolCreate, nFrameBuffers, FRAME_BUFFER_SIZE);
+
+	/* Start the threads the image kernels deal their tiles to; a worker
+	 * whose own tiles are done steals from the others. */
+	OscCall( WorkersStart, NR_WORKERS);
+
+	/* Start writing the detected objects in the background; the
+	 * application runs without if the file cannot be written. */
+	if(TelemetryStart(TELEMETRY_FN) != SUCCESS)
+	{
+		OscLog(WARN, "Telemetry disabled: unable to write %s.\n", TELEMETRY_FN);
+	}
 
 OscFunctionCatch()
 	/* Destruct framwork due to error above. */
+	FramePoolDestroy();
+	TraceStop();
 	OscDestroy();
 	OscMark_m( "Initialization failed!");
 
@@ -91,7 +138,17 @@ OscFunction( mainFunction, const int argc, const char * argv[])
 
 	StateControl();
 
+	/* The pipeline has ended: write the records still in the ring, join
+	 * the workers, then the trace up to the end of the pipeline. */
+	TelemetryStop();
+	WorkersStop();
+	FramePoolDestroy();
+	TraceStop();
+
 OscFunctionCatch()
+	TelemetryStop();
+	WorkersStop();
+	FramePoolDestroy();
 	OscDestroy();
 	OscLog(INFO, "Quit application abnormally!\n");
 OscFunctionEnd()
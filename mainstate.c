@@ -11,18 +11,35 @@
 
 #include "template.h"
 #include "mainstate.h"
+#include "arena.h"
+#include "workers.h"
+#include "queue.h"
+#include "framepool.h"
+#include "stagetimes.h"
+#include "trace.h"
+#include "imagering.h"
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 
 const Msg mainStateMsg[] = {
-	{ FRAMESEQ_EVT },
-	{ FRAMEPAR_EVT },
+	{ FRAMEDONE_EVT },
 	{ IPC_GET_APP_STATE_EVT },
-	{ IPC_GET_NEW_IMG_EVT },
 	{ IPC_SET_IMAGE_TYPE_EVT }
 };
 
+/*! @brief The names of the events in the trace. */
+static const char * const mainStateMsgNames[] = {
+	"FRAMEDONE_EVT",
+	"IPC_GET_APP_STATE_EVT",
+	"IPC_SET_IMAGE_TYPE_EVT"
+};
+
 /*********************************************************************//*!
  * @brief Inline function to throw an event to be handled by the statemachine.
  *
@@ -32,12 +49,221 @@ const Msg mainStateMsg[] = {
 void ThrowEvent(struct MainState *pHsm, unsigned int evt)
 {
 	const Msg *pMsg = &mainStateMsg[evt];
+	TraceBegin(mainStateMsgNames[evt], evt);
 	HsmOnEvent((Hsm*)pHsm, pMsg);
+	TraceEnd(mainStateMsgNames[evt]);
+}
+
+/*! @brief The stages of the frame pipeline and the queues of frame
+ * buffers between them: the acquire stage hands captured frames to the
+ * process stage, the process stage processed frames to the publish stage,
+ * which runs with the IPC in the reactor of the calling thread of
+ * StateControl and hands the frame buffers back to the acquire stage. */
+static struct
+{
+	pthread_t acquireThread, processThread;
+	bool bAcquireStarted, bProcessStarted;
+	struct FRAME_QUEUE ready, done, free;
+	/*! @brief Set when the stages have to terminate. */
+	bool bStop;
+	/*! @brief eventfd signaled along with bStop, wakes the reactor. */
+	int stopFd;
+	/*! @brief The error a stage terminated with. */
+	OSC_ERR err;
+	/*! @brief The frame buffer being published. */
+	uint8 iPublished;
+	/*! @brief Number of frames published. */
+	uint32 nPublished;
+	/*! @brief When the web interface last asked for a frame (ns). */
+	uint64_t viewerNs;
+	/*! @brief The last frame published in the image ring. */
+	uint32 nImageFrame;
+} Pipeline;
+
+/*! @brief A monotonic time (ns). */
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*! @brief The web interface asked for a frame: the frames are published
+ * in the image ring from now on, for VIEWER_TIMEOUT. */
+static void ViewerSeen(void)
+{
+	__atomic_store_n(&Pipeline.viewerNs, NowNs(), __ATOMIC_RELAXED);
 }
 
+/*! @brief Protects the parameters set by the web interface (threshold,
+ * morphology, color classes, exposure time and the flags going with them)
+ * while the IPC stage changes them and the other stages read them. */
+static pthread_mutex_t ParamLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! @brief The counters at the start of the current period of the load
+ * statistics. */
+static struct
+{
+	uint64_t wallNs;
+	uint64_t cpuUs;
+	struct REACTOR_STATS loop;
+} LoadStats;
+
 /*********************************************************************//*!
- * @brief Checks for IPC events, schedules their handling and
- * acknowledges any executed ones.
+ * @brief Select the image published with every frame from the next one
+ * on.
+ *
+ * @param nImage The image (enum IMG_TYPE).
+ * @param bAddInfo Whether to append the drawing info.
+ *//*********************************************************************/
+static void PublishImage(unsigned int nImage, bool bAddInfo)
+{
+	data.ipc.nPublishedImage = nImage;
+	data.ipc.bPublishedAddInfo = bAddInfo;
+}
+
+/*! @brief Set the exposure time from the next frame on. */
+static void SetExposureTime(int nExposureTime)
+{
+	if(data.ipc.state.nExposureTime != nExposureTime)
+	{
+		data.nExposureTimeChanged = true;
+		data.ipc.state.nExposureTime = nExposureTime;
+	}
+}
+
+/*! @brief Set the additional info; a change of its first bit resets the
+ * processing. */
+static void SetAddInfo(int nAddInfo)
+{
+	if(data.ipc.state.nAddInfo != nAddInfo)
+	{
+		//here the different bits can be checked
+		if((data.ipc.state.nAddInfo & 0x01) != (nAddInfo & 0x01))
+			data.nResetProcessing = true;
+
+		data.ipc.state.nAddInfo = nAddInfo;
+	}
+}
+
+/*! @brief Set the threshold of the change detection. */
+static void SetThreshold(int nThreshold)
+{
+	if(data.ipc.state.nThreshold != nThreshold)
+	{
+		data.ipc.state.nThreshold = nThreshold;
+		data.bClassTableDirty = true;
+	}
+}
+
+/*! @brief Whether the entries of a color class table are valid. */
+static bool ColorClassesValid(const struct COLOR_CLASS_TABLE *pTable)
+{
+	bool bValid = (pTable->nClasses <= MAX_NUM_COLOR_CLASSES);
+	uint32 i;
+
+	for(i = 0; bValid && i < pTable->nClasses; i++)
+	{
+		bValid = (pTable->classes[i].color < MAX_NUM_COLORS);
+	}
+	return bValid;
+}
+
+/*! @brief Whether a morphology is valid. */
+static bool MorphValid(const struct MORPH_PARAMS *pMorph)
+{
+	return pMorph->op >= 0 && pMorph->op < MAX_NUM_MORPH_OPS &&
+			pMorph->width >= 1 && pMorph->width <= MORPH_MAX_SIZE &&
+			pMorph->height >= 1 && pMorph->height <= MORPH_MAX_SIZE;
+}
+
+/*! @brief Whether the value of the request being handled (or the reply
+ * asked for by a get request) has the size of its parameter; else the
+ * request is negative acknowledged. */
+static bool RequestSizeValid(uint32 size)
+{
+	if(data.ipc.req.length != size)
+	{
+		OscLog(ERROR, "%s: invalid size of parameter %u (%u bytes)!\n", __func__, data.ipc.req.paramID, data.ipc.req.length);
+		data.ipc.enReqState = REQ_STATE_NACK_PENDING;
+		return false;
+	}
+	return true;
+}
+
+/*********************************************************************//*!
+ * @brief Handle a SET_OPTIONS_GET_STATE request: set all of its options or,
+ * if one is invalid, none and negative acknowledge; reply with the state
+ * they result in.
+ *
+ * Called with the parameters locked, so that no frame is processed with
+ * only some of the options set.
+ *
+ * @param pMainState Initalized HSM main state variable.
+ *//*********************************************************************/
+static void SetOptionsGetState(MainState *pMainState)
+{
+	struct IPC_REQUEST *pReq = &data.ipc.req;
+	struct IPC_STATE_REPLY *pReply = (struct IPC_STATE_REPLY*)pReq->pAddr;
+	struct IPC_OPTIONS options;
+	struct MORPH_PARAMS morph = data.ipc.state.morph;
+
+	if(!RequestSizeValid(sizeof(options)))
+		return;
+	/* the reply overwrites the request */
+	memcpy(&options, pReq->pAddr, sizeof(options));
+
+	if(options.setFlags & OPT_MORPH_OP)
+		morph.op = options.morph.op;
+	if(options.setFlags & OPT_MORPH_WIDTH)
+		morph.width = options.morph.width;
+	if(options.setFlags & OPT_MORPH_HEIGHT)
+		morph.height = options.morph.height;
+	if(((options.setFlags & OPT_IMAGE_TYPE) && options.nImageType >= MAX_NUM_IMG) ||
+			!MorphValid(&morph) ||
+			((options.setFlags & OPT_COLOR_CLASSES) && !ColorClassesValid(&options.colorClasses)) ||
+			((options.setFlags & OPT_OTSU_SAMPLE_STEP) &&
+			(options.nOtsuSampleStep < 1 || options.nOtsuSampleStep > OTSU_MAX_SAMPLE_STEP)))
+	{
+		OscLog(ERROR, "%s: invalid options (0x%x), none set!\n", __func__, options.setFlags);
+		data.ipc.enReqState = REQ_STATE_NACK_PENDING;
+		return;
+	}
+
+	if(options.setFlags & OPT_EXPOSURE_TIME)
+		SetExposureTime(options.nExposureTime);
+	if(options.setFlags & OPT_ADDINFO)
+		SetAddInfo(options.nAddInfo);
+	if(options.setFlags & OPT_THRESHOLD)
+		SetThreshold(options.nThreshold);
+	data.ipc.state.morph = morph;
+	if(options.setFlags & OPT_OTSU_SAMPLE_STEP)
+		data.ipc.state.nOtsuSampleStep = options.nOtsuSampleStep;
+	if(options.setFlags & OPT_COLOR_CLASSES)
+	{
+		data.colorClasses = options.colorClasses;
+		data.bClassTableDirty = true;
+	}
+	if(options.setFlags & OPT_IMAGE_TYPE)
+	{
+		data.ipc.state.nImageType = options.nImageType;
+		ThrowEvent(pMainState, IPC_SET_IMAGE_TYPE_EVT);
+	}
+
+	/* the state, the frame it shows is taken by the web interface */
+	ThrowEvent(pMainState, IPC_GET_APP_STATE_EVT);
+	if(data.ipc.state.nImageFrame != 0)
+	{
+		data.ipc.state.bNewImageReady = FALSE;
+	}
+	StageTimesGet(&pReply->stageTimes);
+	pReq->replyLength = sizeof(*pReply);
+}
+
+/*********************************************************************//*!
+ * @brief Handles the IPC requests read from all connections in turn and
+ * acknowledges each right away.
  *
  * @param pMainState Initalized HSM main state variable.
  * @return 0 on success or an appropriate error code.
@@ -47,27 +273,30 @@ static OSC_ERR HandleIpcRequests(MainState *pMainState)
 	OSC_ERR err;
 	uint32 paramId;
 	struct IPC_DATA *pIpc = &data.ipc;
-	struct OSC_IPC_REQUEST *pReq = &pIpc->req;
+	struct IPC_REQUEST *pReq = &pIpc->req;
 
-	err = CheckIpcRequests(&paramId);
-	if (err == SUCCESS)
+	while ((err = CheckIpcRequests(&paramId)) == SUCCESS)
 	{
 		/* We have a request. See to it that it is handled
-		 * depending on the state we're in. */
+		 * depending on the state we're in. Parameters are only changed
+		 * while the other stages cannot read them. */
+		TraceBegin("IPC request", paramId);
+		pthread_mutex_lock(&ParamLock);
 		switch(paramId)
 		{
 		case GET_APP_STATE:
 			/* Request for the current state of the application. */
+			if(!RequestSizeValid(sizeof(struct APPLICATION_STATE)))
+				break;
 			ThrowEvent(pMainState, IPC_GET_APP_STATE_EVT);
 			break;
-		case GET_NEW_IMG:
-			/* Request for the live image. */
-			ThrowEvent(pMainState, IPC_GET_NEW_IMG_EVT);
-			break;
 		case SET_IMAGE_TYPE:
 		{
 			/* Set the new image type. */
-			unsigned int ImgTyp = *((unsigned int*)data.ipc.req.pAddr);
+			unsigned int ImgTyp;
+			if(!RequestSizeValid(sizeof(ImgTyp)))
+				break;
+			ImgTyp = *((unsigned int*)data.ipc.req.pAddr);
 			if(MAX_NUM_IMG <= ImgTyp)
 			{
 				OscLog(ERROR, "%obtained unknown image type: %u! Will leave unchanged\n", data.ipc.state.nImageType);
@@ -82,58 +311,125 @@ static OSC_ERR HandleIpcRequests(MainState *pMainState)
 		}
 		case SET_EXPOSURE_TIME:
 			// a new exposure time was given
-			if(data.ipc.state.nExposureTime != *((int*)pReq->pAddr))
-			{
-				data.nExposureTimeChanged = true;
-				data.ipc.state.nExposureTime = *((int*)pReq->pAddr);
-			}
+			if(!RequestSizeValid(sizeof(int)))
+				break;
+			SetExposureTime(*((int*)pReq->pAddr));
 			data.ipc.enReqState = REQ_STATE_ACK_PENDING;//we return immediately
 			break;
 		case SET_ADDINFO:
 			// new additional info was given
-			if(data.ipc.state.nAddInfo != *((int*)pReq->pAddr))
-			{
-				//here the different bits can be checked
-				if((data.ipc.state.nAddInfo & 0x01) != (*((int*)pReq->pAddr) & 0x01))
-					data.nResetProcessing = true;
-
-				data.ipc.state.nAddInfo = *((int*)pReq->pAddr);
-			}
+			if(!RequestSizeValid(sizeof(int)))
+				break;
+			SetAddInfo(*((int*)pReq->pAddr));
 			data.ipc.enReqState = REQ_STATE_ACK_PENDING;//we return immediately
 			break;
 		case SET_THRESHOLD:
-			// a new exposure time was given
-			if(data.ipc.state.nThreshold != *((int*)pReq->pAddr))
+			// a new threshold was given
+			if(!RequestSizeValid(sizeof(int)))
+				break;
+			SetThreshold(*((int*)pReq->pAddr));
+			data.ipc.enReqState = REQ_STATE_ACK_PENDING;//we return immediately
+			break;
+		case SET_COLOR_CLASSES:
+		{
+			/* a new set of foreground color classes was given */
+			struct COLOR_CLASS_TABLE *pTable = (struct COLOR_CLASS_TABLE*)pReq->pAddr;
+			if(!RequestSizeValid(sizeof(*pTable)))
+				break;
+			if(ColorClassesValid(pTable))
+			{
+				memcpy(&data.colorClasses, pTable, sizeof(struct COLOR_CLASS_TABLE));
+				data.bClassTableDirty = true;
+				data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+			}
+			else
 			{
-				data.ipc.state.nThreshold = *((int*)pReq->pAddr);
+				OscLog(ERROR, "%s: invalid color class table (%u classes)!\n", __func__, pTable->nClasses);
+				data.ipc.enReqState = REQ_STATE_NACK_PENDING;
 			}
+			break;
+		}
+		case GET_STAGE_TIMES:
+			/* the latencies of the stages up to now */
+			if(!RequestSizeValid(sizeof(struct STAGE_TIMES)))
+				break;
+			StageTimesGet((struct STAGE_TIMES*)pReq->pAddr);
+			data.ipc.enReqState = REQ_STATE_ACK_PENDING;//we return immediately
+			break;
+		case GET_COLOR_CLASSES:
+			if(!RequestSizeValid(sizeof(struct COLOR_CLASS_TABLE)))
+				break;
+			memcpy(pReq->pAddr, &data.colorClasses, sizeof(struct COLOR_CLASS_TABLE));
 			data.ipc.enReqState = REQ_STATE_ACK_PENDING;//we return immediately
 			break;
+		case SET_MORPHOLOGY:
+		{
+			/* a new morphology for the foreground mask was given */
+			struct MORPH_PARAMS *pMorph = (struct MORPH_PARAMS*)pReq->pAddr;
+			if(!RequestSizeValid(sizeof(*pMorph)))
+				break;
+			if(MorphValid(pMorph))
+			{
+				data.ipc.state.morph = *pMorph;
+				data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+			}
+			else
+			{
+				OscLog(ERROR, "%s: invalid morphology (%d, %dx%d)!\n", __func__, pMorph->op, pMorph->width, pMorph->height);
+				data.ipc.enReqState = REQ_STATE_NACK_PENDING;
+			}
+			break;
+		}
+		case SET_OPTIONS_GET_STATE:
+			/* options and state in one round trip */
+			ViewerSeen();
+			SetOptionsGetState(pMainState);
+			break;
+		case WAIT_NEW_FRAME:
+		{
+			/* answered right away if the web interface has not seen the
+			 * newest frame yet, else with the next one */
+			uint32 *pFrame = (uint32*)pReq->pAddr;
+			if(!RequestSizeValid(sizeof(uint32)))
+				break;
+			ViewerSeen();
+			if(*pFrame != data.ipc.state.nImageFrame)
+			{
+				*pFrame = data.ipc.state.nImageFrame;
+				pReq->replyLength = sizeof(uint32);
+				data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+			}
+			else
+			{
+				data.ipc.enReqState = REQ_STATE_FRAME_PENDING;
+			}
+			break;
+		}
 		default:
 			OscLog(ERROR, "%s: Unkown IPC parameter ID (%d)!\n", __func__, paramId);
 			data.ipc.enReqState = REQ_STATE_NACK_PENDING;
 			break;
 		}
+		pthread_mutex_unlock(&ParamLock);
+		TraceEnd("IPC request");
+
+		/* The reply is written as far as the connection takes it, the
+		 * rest follows while the other connections are served. */
+		err = AckIpcRequests();
+		if (err != SUCCESS)
+		{
+			OscLog(ERROR, "%s: IPC acknowledge error! (%d)\n", __func__, err);
+			return err;
+		}
 	}
-	else if (err == -ENO_MSG_AVAIL)
-	{
-		/* No new message available => do nothing. */
-	}
-	else
+	if (err != -ENO_MSG_AVAIL)
 	{
 		/* Error.*/
 		OscLog(ERROR, "%s: IPC request error! (%d)\n", __func__, err);
 		return err;
 	}
-
-	/* Try to acknowledge the new or any old unacknowledged
-	 * requests. It may take several tries to succeed.*/
-	err = AckIpcRequests();
-	if (err != SUCCESS)
-	{
-		OscLog(ERROR, "%s: IPC acknowledge error! (%d)\n", __func__, err);
-	}
-	return err;
+	/* No new message available => done. */
+	return SUCCESS;
 }
 
 Msg const *MainState_top(MainState *me, Msg *msg)
@@ -145,46 +441,55 @@ Msg const *MainState_top(MainState *me, Msg *msg)
 		/* initialize the whole stuff - is this the right place ? */
 		STATE_START(me, &me->showGray);
 		data.ipc.state.enAppMode = APP_CAPTURE_ON;
-		data.pCurRawImg = data.u8FrameBuffers[0];
 		data.nExposureTimeChanged = true;
 		data.nResetProcessing = false;
 		data.AddBufSize = 0;
 		data.ipc.state.nExposureTime = 25;
 		data.ipc.state.nStepCounter = 0;
 		data.ipc.state.nThreshold = 0;
+		SetDefaultColorClasses();
+		/* gray images are opened with a 3x3 square, color masks are used as is */
+		data.ipc.state.morph.op = (NUM_COLORS == 1) ? MORPH_OPEN : MORPH_NONE;
+		data.ipc.state.morph.width = 3;
+		data.ipc.state.morph.height = 3;
 		return 0;
 	case IPC_GET_APP_STATE_EVT:
+	{
+		struct FRAME_POOL_STATS poolStats;
+		int i;
+
+		/* the frame buffers as they are right now */
+		data.ipc.state.nFrameBuffers = FramePoolDepth();
+		for(i = 0; i < data.ipc.state.nFrameBuffers; i++)
+		{
+			data.ipc.state.frameBufferState[i] = FramePoolGetState(i);
+		}
+		FramePoolGetStats(&poolStats);
+		data.ipc.state.nFramesCaptured = poolStats.nCaptured;
+		data.ipc.state.nCameraWaits = poolStats.nWaits;
+		data.ipc.state.cameraWaitMs = poolStats.waitMs;
+
 		/* Fill in the response and schedule an acknowledge for the request. */
 		pState = (struct APPLICATION_STATE*)data.ipc.req.pAddr;
 		memcpy(pState, &data.ipc.state, sizeof(struct APPLICATION_STATE));
 
 		data.ipc.enReqState = REQ_STATE_ACK_PENDING;
 		return 0;
-	case FRAMESEQ_EVT:
-		/* Timestamp the capture of the image. */
-		data.ipc.state.imageTimeStamp = OscSupCycGet();
-		data.ipc.state.bNewImageReady = TRUE;
-		/* Sleep here for a short while in order not to violate the vertical
-		 * blank time of the camera sensor when triggering a new image
-		 * right after receiving the old one. This can be removed if some
-		 * heavy calculations are done here. */
-		//usleep(4000);
-		return 0;
-	case FRAMEPAR_EVT:
+	}
+	case FRAMEDONE_EVT:
 	{
-		/* we have a new image increase counter: here and only here! */
-		data.ipc.state.nStepCounter++;
-		/* debayer the image first -> to half size*/
-#if NUM_COLORS == 1
-		OscVisDebayerGreyscaleHalfSize(data.pCurRawImg, OSC_CAM_MAX_IMAGE_WIDTH, OSC_CAM_MAX_IMAGE_HEIGHT, ROW_YUYV, data.u8TempImage[SENSORIMG]);
-#else
-		memcpy(data.u8TempImage[SENSORIMG], data.pCurRawImg, NUM_COLORS*OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH);
-#endif
-		/* Process the image. */
-		//set data buffer to zero before each step
-		data.AddBufSize = 0;
-		ProcessFrame();
+		/* publish the results of the frame the process stage is done with */
+		const struct FRAME_INFO *pInfo = &data.frameInfo[Pipeline.iPublished];
 
+		data.ipc.state.imageTimeStamp = pInfo->imageTimeStamp;
+		data.ipc.state.nStepCounter = pInfo->nStepCounter;
+		data.ipc.state.nImageFrame = pInfo->nImageFrame;
+		data.ipc.state.nFrameBytesRead = pInfo->memTraffic.nBytesRead;
+		data.ipc.state.nFrameBytesWritten = pInfo->memTraffic.nBytesWritten;
+		data.ipc.state.nWorkers = pInfo->nWorkers;
+		memcpy(data.ipc.state.workerUtilization, pInfo->workerUtilization, sizeof(pInfo->workerUtilization));
+		data.ipc.state.nTilesStolen = pInfo->nTilesStolen;
+		data.ipc.state.bNewImageReady = TRUE;
 		return 0;
 	}
 	case IPC_SET_IMAGE_TYPE_EVT:
@@ -204,10 +509,6 @@ Msg const *MainState_top(MainState *me, Msg *msg)
 		data.ipc.enReqState = REQ_STATE_ACK_PENDING;
 		return 0;
 	}
-	case IPC_GET_NEW_IMG_EVT:
-		/* If the IPC event is not handled in the actual substate, a negative acknowledge is returned by default. */
-		data.ipc.enReqState = REQ_STATE_NACK_PENDING;
-	return 0;
 	}
 	return msg;
 }
@@ -216,25 +517,11 @@ Msg const *MainState_ShowGray(MainState *me, Msg *msg)
 {
 	switch (msg->evt)
 	{
-	case IPC_GET_NEW_IMG_EVT:
-	{
-		/* Write out the current gray image to the address space of the CGI. */
-		memcpy(data.ipc.req.pAddr, data.u8TempImage[SENSORIMG], sizeof(data.u8TempImage[SENSORIMG]));
-		/* always copy the size of the additional data buffer (because it is read in cgi.c */
-		memcpy(data.ipc.req.pAddr+sizeof(data.u8TempImage[SENSORIMG]), &data.AddBufSize, sizeof(uint32));
-		if(data.AddBufSize)
-		{
-			memcpy(data.ipc.req.pAddr+sizeof(data.u8TempImage[SENSORIMG])+sizeof(uint32), data.u8TempImage[ADDINFO], data.AddBufSize*sizeof(uint8));
-		}
-
-		data.ipc.state.bNewImageReady = FALSE;
-
-		/* Mark the request as executed, so it will be acknowledged later. */
-		data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+	case ENTRY_EVT:
+		/* The gray image with the drawing info. */
+		PublishImage(SENSORIMG, TRUE);
 		return 0;
 	}
-
-	}
 	return msg;
 }
 
@@ -242,22 +529,10 @@ Msg const *MainState_ShowThreshold(MainState *me, Msg *msg)
 {
 	switch (msg->evt)
 	{
-	case IPC_GET_NEW_IMG_EVT:
-	{
-		uint32 AddInfoSize = 0;
-		/* Write out the image to the address space of the CGI. */
-		memcpy(data.ipc.req.pAddr, data.u8TempImage[THRESHOLD], sizeof(data.u8TempImage[THRESHOLD]));
-		/* always copy the size of the additional data buffer (because it is read in cgi.c */
-		memcpy(data.ipc.req.pAddr+sizeof(data.u8TempImage[SENSORIMG]), &AddInfoSize, sizeof(uint32));
-
-		data.ipc.state.bNewImageReady = FALSE;
-
-		/* Mark the request as executed, so it will be acknowledged later. */
-		data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+	case ENTRY_EVT:
+		PublishImage(THRESHOLD, FALSE);
 		return 0;
 	}
-
-	}
 	return msg;
 }
 
@@ -265,22 +540,10 @@ Msg const *MainState_ShowBackground(MainState *me, Msg *msg)
 {
 	switch (msg->evt)
 	{
-	case IPC_GET_NEW_IMG_EVT:
-	{
-		uint32 AddInfoSize = 0;
-		/* Write out the current gray image to the address space of the CGI. */
-		memcpy(data.ipc.req.pAddr, data.u8TempImage[BACKGROUND], sizeof(data.u8TempImage[BACKGROUND]));
-		/* always copy the size of the additional data buffer (because it is read in cgi.c */
-		memcpy(data.ipc.req.pAddr+sizeof(data.u8TempImage[SENSORIMG]), &AddInfoSize, sizeof(uint32));
-
-		data.ipc.state.bNewImageReady = FALSE;
-
-		/* Mark the request as executed, so it will be acknowledged later. */
-		data.ipc.enReqState = REQ_STATE_ACK_PENDING;
+	case ENTRY_EVT:
+		PublishImage(BACKGROUND, FALSE);
 		return 0;
 	}
-
-	}
 	return msg;
 }
 
@@ -292,75 +555,530 @@ void MainStateConstruct(MainState *me)
 	StateCtor(&me->showBackground, "Show Background", &((Hsm *)me)->top, (EvtHndlr)MainState_ShowBackground);
 }
 
-OscFunction( StateControl)
 
-	OSC_ERR camErr;
-	MainState mainState;
-	uint8 *pCurRawImg = NULL;
+/*********************************************************************//*!
+ * @brief Make all stages of the pipeline terminate.
+ *
+ * @param err The error of the stage which failed.
+ *//*********************************************************************/
+static void StopPipeline(OSC_ERR err)
+{
+	const uint64_t one = 1;
 
-	/* Setup main state machine */
-	MainStateConstruct(&mainState);
-	HsmOnStart((Hsm *)&mainState);
+	/* the first error is reported */
+	__sync_bool_compare_and_swap(&Pipeline.err, SUCCESS, err);
+	__atomic_store_n(&Pipeline.bStop, TRUE, __ATOMIC_RELEASE);
+	if (write(Pipeline.stopFd, &one, sizeof(one)) != sizeof(one))
+	{
+		OscLog(ERROR, "%s: Unable to wake the publish stage!\n", __func__);
+	}
+}
 
-	OscSimInitialize();
+/*********************************************************************//*!
+ * @brief Whether the stages have to terminate.
+ *
+ * @return TRUE if so.
+ *//*********************************************************************/
+static bool Stopping(void)
+{
+	return __atomic_load_n(&Pipeline.bStop, __ATOMIC_ACQUIRE);
+}
+
+/*! @brief A monotonic time (ms). */
+static uint32 NowMs(void)
+{
+	struct timespec ts;
 
-	/* Prologue: initial acquisition setup */
-	OscCall( OscCamSetupCapture, OSC_CAM_MULTI_BUFFER);
-	OscCall( OscGpioTriggerImage);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-	/* Body: infinite acquisition loop */
-	while (TRUE)
+/*********************************************************************//*!
+ * @brief The acquire stage: triggers the camera whenever a frame buffer
+ * is free and hands the captured frames to the process stage.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OscFunction( static AcquireStage)
+
+	OSC_ERR camErr;
+	uint8 *pRawImg = NULL;
+	/* the frame buffer the camera fills next */
+	int iNext = 0;
+	uint32 nFrames = 0;
+	uint32 shutterWidth = 0;
+	bool bNewShutter;
+	bool bWaited = FALSE;
+	uint32 waitStart = 0;
+	uint32 waitMs;
+	uint32 captureCyc;
+	int handle;
+
+	while (!Stopping())
 	{
-		/* Wait for captured picture. While a timeout is reported we do service
-		 * web interface and GPIO meanwhile. Otherwise we quick. One IPC request
-		 * is processed at least. */
-		while (TRUE)
+		/* take back the frame buffers the other stages are done with */
+		while ((handle = QueuePop(&Pipeline.free, 0)) >= 0)
 		{
-			OscCall( HandleIpcRequests, &mainState);
-
-			camErr = OscCamReadPicture(OSC_CAM_MULTI_BUFFER, &pCurRawImg, 0, 4);
-			if( camErr == -ETIMEOUT)
+			FramePoolSetState(handle, FRAME_BUFFER_FREE);
+		}
+		/* The camera fills the frame buffers in the order of their IDs, so
+		 * it has to wait until the next one is back. */
+		if (FramePoolGetState(iNext) != FRAME_BUFFER_FREE)
+		{
+			if (!bWaited)
 			{
-				OscCall( HandleIpcRequests, &mainState);
+				bWaited = TRUE;
+				waitStart = NowMs();
+				TraceBegin("Wait for frame buffer", iNext);
 			}
-			else
+			handle = QueuePop(&Pipeline.free, STAGE_TIMEOUT);
+			if (handle >= 0)
 			{
-				break;
+				FramePoolSetState(handle, FRAME_BUFFER_FREE);
 			}
-
+			continue;
+		}
+		/* The wait ends as soon as the buffer is free; the capture below is
+		 * not part of it. */
+		waitMs = 0;
+		if (bWaited)
+		{
+			waitMs = NowMs() - waitStart;
+			TraceEnd("Wait for frame buffer");
 		}
-
-		/* A valid image is expected. */
-		OscAssert_s( camErr == SUCCESS);
-		data.pCurRawImg = pCurRawImg;
-
-		/* Process frame by state engine. Sequentially with next capture */
-		ThrowEvent(&mainState, FRAMESEQ_EVT);
 
 		/* set new shutter speed */
-		if(data.nExposureTimeChanged)
+		pthread_mutex_lock(&ParamLock);
+		bNewShutter = data.nExposureTimeChanged;
+		if (bNewShutter)
 		{
-			OscCamSetShutterWidth(data.ipc.state.nExposureTime * 100);
+			shutterWidth = data.ipc.state.nExposureTime * 100;
 			data.nExposureTimeChanged = false;
 		}
+		pthread_mutex_unlock(&ParamLock);
 
-		/* reset processing */
-		if(data.nResetProcessing)
+		/* The camera drivers are not checked by the allocation guard, see
+		 * arena.h. */
+		AllocGuardSuspend();
+		if (bNewShutter)
 		{
-			ResetProcess();
-			data.nResetProcessing = false;
+			OscCamSetShutterWidth(shutterWidth);
 		}
 
-		/* Prepare next capture */
+		FramePoolSetState(iNext, FRAME_BUFFER_CAPTURING);
+		captureCyc = OscSupCycGet();
 		OscCall( OscCamSetupCapture, OSC_CAM_MULTI_BUFFER);
 		OscCall( OscGpioTriggerImage);
 
-		/* Process frame by state engine. Parallel with next capture */
-		ThrowEvent(&mainState, FRAMEPAR_EVT);
+		/* Wait for the captured picture. */
+		do
+		{
+			camErr = OscCamReadPicture(OSC_CAM_MULTI_BUFFER, &pRawImg, 0, STAGE_TIMEOUT);
+		} while (camErr == -ETIMEOUT && !Stopping());
+		AllocGuardResume();
+		if (Stopping())
+			break;
+
+		/* A valid image is expected. */
+		OscAssert_s( camErr == SUCCESS);
+		StageTimesLap(STAGE_CAPTURE_WAIT, captureCyc);
+		handle = FramePoolHandle(pRawImg);
+		OscAssert_m( handle == iNext, "Frame buffer %d captured instead of %d!", handle, iNext);
+		iNext = (iNext + 1) % FramePoolDepth();
+
+		/* Timestamp the capture of the image. */
+		data.frameInfo[handle].imageTimeStamp = OscSupCycGet();
+		FramePoolCountCapture(bWaited, waitMs);
+		bWaited = FALSE;
+		FramePoolSetState(handle, FRAME_BUFFER_READY);
+		OscCall( QueuePush, &Pipeline.ready, handle);
+
+		/* After the warm-up, the loop must not touch the heap anymore
+		 * (checked in debug builds only). */
+		if(++nFrames == ALLOC_GUARD_WARMUP_FRAMES)
+		{
+			AllocGuardArm();
+		}
 
 		/* Advance the simulation step counter. */
+		AllocGuardSuspend();
 		OscSimStep();
-	} /* end while ever */
+		AllocGuardResume();
+	}
+
+OscFunctionCatch()
+OscFunctionEnd()
+
+/*********************************************************************//*!
+ * @brief Take the parameters set by the web interface for the frame to
+ * be processed.
+ *//*********************************************************************/
+static void TakeFrameParams(void)
+{
+	bool bReset;
+
+	pthread_mutex_lock(&ParamLock);
+	data.frameParams.nThreshold = data.ipc.state.nThreshold;
+	data.frameParams.morph = data.ipc.state.morph;
+	data.frameParams.nOtsuSampleStep = data.ipc.state.nOtsuSampleStep;
+	/* the color classes only change together with the dirty flag */
+	if (data.bClassTableDirty)
+	{
+		data.frameParams.colorClasses = data.colorClasses;
+		data.frameParams.bClassTableDirty = true;
+		data.bClassTableDirty = false;
+	}
+	bReset = data.nResetProcessing;
+	data.nResetProcessing = false;
+	data.frameParams.nImage = data.ipc.nPublishedImage;
+	data.frameParams.bAddInfo = data.ipc.bPublishedAddInfo;
+	pthread_mutex_unlock(&ParamLock);
+
+	/* reset processing */
+	if (bReset)
+	{
+		ResetProcess();
+	}
+}
+
+/*********************************************************************//*!
+ * @brief Process the frame in a frame buffer and record its results.
+ *
+ * @param handle The frame buffer.
+ *//*********************************************************************/
+static void ProcessFrameBuffer(uint8 handle)
+{
+	struct FRAME_INFO *pInfo = &data.frameInfo[handle];
+	uint64_t kernelNs;
+	uint32 lap;
+	int i;
+
+	data.pCurRawImg = FramePoolBuffer(handle);
+	TakeFrameParams();
+
+	/* we have a new image increase counter: here and only here! */
+	data.nStepCounter++;
+	TraceBegin("ProcessFrame", data.nStepCounter);
+	memset(&data.memTraffic, 0, sizeof(data.memTraffic));
+	/* release the scratch memory of the previous frame */
+	FrameArenaReset();
+	lap = OscSupCycGet();
+	/* debayer the image first -> to half size*/
+#if NUM_COLORS == 1
+	OscVisDebayerGreyscaleHalfSize(data.pCurRawImg, OSC_CAM_MAX_IMAGE_WIDTH, OSC_CAM_MAX_IMAGE_HEIGHT, ROW_YUYV, data.u8TempImage[SENSORIMG]);
+	COUNT_MEM_TRAFFIC(NUMCOL_PLANES*OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH, OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH);
+	data.pSensorImg = data.u8TempImage[SENSORIMG];
+#else
+	/* the color image is processed right in the frame buffer, no copy */
+	data.pSensorImg = data.pCurRawImg;
+#endif
+	StageTimesLap(STAGE_SENSOR_IMAGE, lap);
+	/* Process the image. */
+	//set data buffer to zero before each step
+	data.AddBufSize = 0;
+	WorkersResetStats();
+	ProcessFrame();
+
+	/* the memory traffic of this frame */
+	pInfo->nStepCounter = data.nStepCounter;
+	pInfo->memTraffic = data.memTraffic;
+	/* the load balance of the workers in this frame */
+	kernelNs = WorkersKernelNs();
+	pInfo->nWorkers = WorkersCount() < MAX_NUM_WORKERS ? WorkersCount() : MAX_NUM_WORKERS;
+	pInfo->nTilesStolen = 0;
+	for (i = 0; i < pInfo->nWorkers; i++)
+	{
+		const struct WORKER_STATS *pStats = WorkersGetStats(i);
+		const uint64_t percent = kernelNs == 0 ? 0 : pStats->busyNs * 100 / kernelNs;
+		pInfo->workerUtilization[i] = percent > 100 ? 100 : percent;
+		pInfo->nTilesStolen += pStats->nStolen;
+	}
+	TraceEnd("ProcessFrame");
+}
+
+/*********************************************************************//*!
+ * @brief Publish the selected image of the frame just processed for the
+ * web interface.
+ *
+ * Copying the image into the ring costs a pass over it, so it is done
+ * only while the web interface asked for a frame within VIEWER_TIMEOUT;
+ * else the frame keeps the last frame published as its image.
+ *
+ * @param handle The frame buffer.
+ *//*********************************************************************/
+static void PublishFrame(uint8 handle)
+{
+	const struct FRAME_PARAMS *pParams = &data.frameParams;
+	/* all images of a mode have as many channels as the mode has colors */
+	const struct IMAGE_HEADER header = {
+		.nStepCounter = data.nStepCounter,
+		.imageTimeStamp = data.frameInfo[handle].imageTimeStamp,
+		.nImageType = pParams->nImage,
+		.width = OSC_CAM_MAX_IMAGE_WIDTH,
+		.height = OSC_CAM_MAX_IMAGE_HEIGHT,
+		.channels = NUM_COLORS,
+		.stride = NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH,
+		.addInfoSize = pParams->bAddInfo ? data.AddBufSize : 0
+	};
+
+	if (NowNs() - __atomic_load_n(&Pipeline.viewerNs, __ATOMIC_RELAXED) < (uint64_t)VIEWER_TIMEOUT * 1000000)
+	{
+		TraceBegin("PublishFrame", data.nStepCounter);
+		Pipeline.nImageFrame = ImageRingPublish(&header,
+				pParams->nImage == SENSORIMG ? data.pSensorImg : data.u8TempImage[pParams->nImage],
+				data.u8TempImage[ADDINFO]);
+		TraceEnd("PublishFrame");
+	}
+	data.frameInfo[handle].nImageFrame = Pipeline.nImageFrame;
+}
+
+/*********************************************************************//*!
+ * @brief The process stage: processes the captured frames and hands them
+ * to the publish stage.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OscFunction( static ProcessStage)
+
+	uint32 nFrames = 0;
+	int handle;
+
+	while (!Stopping())
+	{
+		handle = QueuePop(&Pipeline.ready, STAGE_TIMEOUT);
+		if (handle < 0)
+			continue;
+		FramePoolSetState(handle, FRAME_BUFFER_PROCESSING);
+
+		ProcessFrameBuffer(handle);
+		/* while the images are not yet overwritten by the next frame */
+		PublishFrame(handle);
+		data.frameInfo[handle].doneCyc = OscSupCycGet();
+		OscCall( QueuePush, &Pipeline.done, handle);
+
+		if(++nFrames == ALLOC_GUARD_WARMUP_FRAMES)
+		{
+			AllocGuardArm();
+		}
+	}
 
 OscFunctionCatch()
 OscFunctionEnd()
+
+static void *AcquireThread(void *pArg)
+{
+	OSC_ERR err;
+
+	TraceThreadName("acquire");
+	err = AcquireStage();
+
+	if (err != SUCCESS)
+	{
+		StopPipeline(err);
+	}
+	return NULL;
+}
+
+static void *ProcessThread(void *pArg)
+{
+	OSC_ERR err;
+
+	TraceThreadName("process");
+	err = ProcessStage();
+
+	if (err != SUCCESS)
+	{
+		StopPipeline(err);
+	}
+	return NULL;
+}
+
+/*********************************************************************//*!
+ * @brief Reactor handler of the web interface: serves the requests.
+ *
+ * @param fd The socket or the connection.
+ * @param events The EPOLL* flags.
+ * @param pContext The main state.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+static OSC_ERR OnIpcEvent(int fd, uint32 events, void *pContext)
+{
+	return HandleIpcRequests((MainState*)pContext);
+}
+
+/*********************************************************************//*!
+ * @brief Reactor handler of the queue of processed frames: the publish
+ * stage. Publishes the frames and hands their buffers back to the camera;
+ * wakes the web interface waiting for them.
+ *
+ * @param fd The eventfd of the queue.
+ * @param events The EPOLL* flags.
+ * @param pContext The main state.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+static OSC_ERR OnFrameDone(int fd, uint32 events, void *pContext)
+{
+	MainState *pMainState = (MainState*)pContext;
+	const uint32 nImageFrame = data.ipc.state.nImageFrame;
+	OSC_ERR err;
+	int handle;
+
+	/* the queue has to be emptied, it is not signaled again before */
+	while ((handle = QueuePop(&Pipeline.done, 0)) >= 0)
+	{
+		Pipeline.iPublished = handle;
+		FramePoolSetState(handle, FRAME_BUFFER_PUBLISHED);
+		ThrowEvent(pMainState, FRAMEDONE_EVT);
+		StageTimesLap(STAGE_PUBLISH, data.frameInfo[handle].doneCyc);
+		/* the camera may fill the frame buffer again */
+		err = QueuePush(&Pipeline.free, handle);
+		if (err != SUCCESS)
+			return err;
+
+		/* After the warm-up, the loop must not touch the heap anymore
+		 * (checked in debug builds only). */
+		if(++Pipeline.nPublished == ALLOC_GUARD_WARMUP_FRAMES)
+		{
+			AllocGuardArm();
+		}
+	}
+	/* the web interface waiting for a frame gets the newest one */
+	if (data.ipc.state.nImageFrame != nImageFrame)
+	{
+		return IpcNotifyFrame(&data.ipc.state.nImageFrame, sizeof(uint32));
+	}
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Reactor handler of the stop eventfd: ends the reactor with the
+ * error of the failed stage.
+ *
+ * @return The error.
+ *//*********************************************************************/
+static OSC_ERR OnStop(int fd, uint32 events, void *pContext)
+{
+	return __atomic_load_n(&Pipeline.err, __ATOMIC_ACQUIRE);
+}
+
+/*********************************************************************//*!
+ * @brief Reactor handler of SIGUSR1: writes the trace.
+ *
+ * @param fd The signalfd.
+ * @return SUCCESS.
+ *//*********************************************************************/
+static OSC_ERR OnTraceDump(int fd, uint32 events, void *pContext)
+{
+	struct signalfd_siginfo info;
+
+	while (read(fd, &info, sizeof(info)) == sizeof(info))
+	{
+		/* the signals pending are answered by one trace */
+	}
+	TraceDump();
+	return SUCCESS;
+}
+
+/*********************************************************************//*!
+ * @brief Reactor timer: the CPU load of the application, how much the
+ * publish loop sleeps and how quickly it answers the web interface, over
+ * the last period. Answers the requests still waiting for a frame.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+static OSC_ERR OnLoadStats(int fd, uint32 events, void *pContext)
+{
+	struct APPLICATION_STATE *pState = &data.ipc.state;
+	struct REACTOR_STATS loop;
+	struct IPC_STATS ipc;
+	struct rusage usage;
+	const uint64_t wallNs = NowNs();
+	uint64_t cpuUs, periodNs;
+
+	getrusage(RUSAGE_SELF, &usage);
+	cpuUs = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+			usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	ReactorGetStats(&loop);
+	IpcTakeStats(&ipc);
+
+	periodNs = wallNs - LoadStats.wallNs;
+	if (LoadStats.wallNs != 0 && periodNs != 0)
+	{
+		pState->cpuLoad = (cpuUs - LoadStats.cpuUs) * 100000 / periodNs;
+		pState->loopIdle = (loop.idleNs - LoadStats.loop.idleNs) * 100 / periodNs;
+		pState->loopWakeups = (uint64_t)(loop.nWakeups - LoadStats.loop.nWakeups) * 1000000000 / periodNs;
+	}
+	pState->ipcLatencyUs = ipc.nRequests == 0 ? 0 : ipc.latencyNs / ipc.nRequests / 1000;
+	pState->ipcLatencyMaxUs = ipc.maxLatencyNs / 1000;
+
+	LoadStats.wallNs = wallNs;
+	LoadStats.cpuUs = cpuUs;
+	LoadStats.loop = loop;
+
+	/* no one waits for a frame longer than a period, should the camera
+	 * have stopped */
+	return IpcNotifyFrame(&data.ipc.state.nImageFrame, sizeof(uint32));
+}
+
+OscFunction( StateControl)
+
+	MainState mainState;
+	OSC_ERR err;
+
+	/* Setup main state machine */
+	MainStateConstruct(&mainState);
+	HsmOnStart((Hsm *)&mainState);
+
+	OscSimInitialize();
+
+	/* Prologue: the queues and the threads of the acquire and the process
+	 * stage */
+	Pipeline.bStop = FALSE;
+	Pipeline.err = SUCCESS;
+	/* the first frames are published, so that there is one to show */
+	ViewerSeen();
+	Pipeline.stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	OscAssert_m( Pipeline.stopFd >= 0, "Unable to create the stop eventfd!");
+	OscCall( ImageRingCreate);
+	OscCall( QueueInit, &Pipeline.ready);
+	OscCall( QueueInit, &Pipeline.done);
+	OscCall( QueueInit, &Pipeline.free);
+	OscAssert_m( pthread_create(&Pipeline.processThread, NULL, ProcessThread, NULL) == 0,
+			"Unable to start the process stage!");
+	Pipeline.bProcessStarted = TRUE;
+	OscAssert_m( pthread_create(&Pipeline.acquireThread, NULL, AcquireThread, NULL) == 0,
+			"Unable to start the acquire stage!");
+	Pipeline.bAcquireStarted = TRUE;
+
+	/* The publish stage and the web interface run in the reactor and are
+	 * woken by processed frames, requests, the stop of the pipeline and
+	 * the timer of the load statistics only. */
+	OscCall( ReactorCreate);
+	OscCall( IpcServerCreate, USER_INTERFACE_SOCKET_PATH, data.nIpcClients, OnIpcEvent, &mainState);
+	OscCall( ReactorAdd, QueueFd(&Pipeline.done), EPOLLIN, OnFrameDone, &mainState);
+	OscCall( ReactorAdd, Pipeline.stopFd, EPOLLIN, OnStop, NULL);
+	OscCall( ReactorAddTimer, LOAD_STATS_PERIOD, OnLoadStats, NULL);
+	if (TraceFd() >= 0)
+	{
+		TraceThreadName("publish");
+		OscCall( ReactorAdd, TraceFd(), EPOLLIN, OnTraceDump, NULL);
+	}
+
+	/* Body: runs until a stage fails. */
+	err = ReactorRun();
+	OscFail_m( "A pipeline stage failed! (%d)", err);
+
+OscFunctionCatch()
+	StopPipeline(-EDEVICE);
+	if (Pipeline.bAcquireStarted)
+	{
+		pthread_join(Pipeline.acquireThread, NULL);
+	}
+	if (Pipeline.bProcessStarted)
+	{
+		pthread_join(Pipeline.processThread, NULL);
+	}
+	IpcServerDestroy();
+	ReactorDestroy();
+	ImageRingDestroy();
+OscFunctionEnd()
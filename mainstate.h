@@ -13,10 +13,8 @@
 #include "template.h"
 
 enum MainStateEvents {
-	FRAMESEQ_EVT,       /* frame ready to process (before setting up next frame capture) */
-	FRAMEPAR_EVT,       /* frame ready to process (parallel to next capture) */
+	FRAMEDONE_EVT,      /* frame processed, its results are to be published */
 	IPC_GET_APP_STATE_EVT, /* Webinterface asks for the current application state. */
-	IPC_GET_NEW_IMG_EVT, /* Webinterface asks for a new image. */
 	IPC_SET_IMAGE_TYPE_EVT /* Webinterface wants to set the image type. */
 };
 
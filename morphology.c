@@ -0,0 +1,196 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file morphology.c
+ * @brief Binary morphology with rectangular structuring elements of any
+ * size on bit-packed masks.
+ */
+
+#include "morphology.h"
+#include <string.h>
+
+/*! @brief Number of words of a row including one zero margin word on
+ * either side; the margins take the bits shifted out of the image, which
+ * is enough as long as MORPH_MAX_SIZE <= 64. */
+#define MORPH_ROW_WORDS (MASK_MAX_WORDS_PER_ROW + 2)
+
+/*! @brief Shift a row with margins: bit c of the result is bit c + s of
+ * the source (s may be negative); bits from beyond the row are 0. */
+static void ShiftRow(const uint64_t *pSrc, uint64_t *pDst, int nw, int s)
+{
+	int ws = (s >= 0 ? s : -s) / 64;
+	int bs = (s >= 0 ? s : -s) % 64;
+	int w;
+
+	for (w = 0; w < nw; w++)
+	{
+		if (s >= 0)
+		{
+			uint64_t lo = (w + ws < nw) ? pSrc[w + ws] : 0;
+			uint64_t hi = (w + ws + 1 < nw) ? pSrc[w + ws + 1] : 0;
+			pDst[w] = bs ? (lo >> bs) | (hi << (64 - bs)) : lo;
+		}
+		else
+		{
+			uint64_t hi = (w - ws >= 0) ? pSrc[w - ws] : 0;
+			uint64_t lo = (w - ws - 1 >= 0) ? pSrc[w - ws - 1] : 0;
+			pDst[w] = bs ? (hi << bs) | (lo >> (64 - bs)) : hi;
+		}
+	}
+}
+
+/*! @brief Combine each pixel of a row with its horizontal neighbors
+ * c - before ... c + after. The window is built by doubling: after step i
+ * every bit holds the AND (OR) of the 2^i bits starting at it, which
+ * takes log2(width) word operations per 64 pixels. */
+static void MorphRow(const uint64_t *pSrc, uint64_t *pDst, int nw, int width, int before, int after, bool bErode)
+{
+	const int len = before + after + 1;
+	const int rest = width % 64;
+	const uint64_t lastMask = rest ? ((uint64_t)1 << rest) - 1 : ~(uint64_t)0;
+	uint64_t acc[MORPH_ROW_WORDS], sh[MORPH_ROW_WORDS], res[MORPH_ROW_WORDS];
+	int w, m;
+
+	acc[0] = acc[nw + 1] = 0;
+	memcpy(&acc[1], pSrc, nw * sizeof(uint64_t));
+
+	for (m = 1; 2 * m <= len; m *= 2)
+	{
+		ShiftRow(acc, sh, nw + 2, m);
+		for (w = 0; w < nw + 2; w++)
+			acc[w] = bErode ? (acc[w] & sh[w]) : (acc[w] | sh[w]);
+	}
+	if (m < len)
+	{
+		/* the two overlapping windows of length m cover len bits */
+		ShiftRow(acc, sh, nw + 2, len - m);
+		for (w = 0; w < nw + 2; w++)
+			acc[w] = bErode ? (acc[w] & sh[w]) : (acc[w] | sh[w]);
+	}
+	/* bit c holds the window starting at c, move it to c + before */
+	ShiftRow(acc, res, nw + 2, -before);
+	memcpy(pDst, &res[1], nw * sizeof(uint64_t));
+	pDst[nw - 1] &= lastMask;
+}
+
+/*! @brief Erode or dilate the rows firstRow ... endRow - 1 with the
+ * rectangle of the columns c - left ... c + right and the rows r - up ...
+ * r + down. The horizontal pass covers the stripe and its halo rows and
+ * writes to the scratch memory; the vertical pass (van Herk/Gil-Werman)
+ * cuts the zero padded column of these rows into blocks of the window
+ * length: every window is the suffix of one block and the prefix of the
+ * next, so each output word costs three word operations whatever the
+ * window length. */
+static void MorphStripe(const struct BIT_MASK *pIn, struct BIT_MASK *pOut,
+		int left, int right, int up, int down, bool bErode,
+		int firstRow, int endRow, struct MORPH_SCRATCH *pScratch)
+{
+	const int nw = pIn->wordsPerRow;
+	const int len = up + down + 1;
+	/* padded row i is image row firstRow - up + i */
+	const int n = endRow - firstRow + len - 1;
+	int i, w;
+
+	for (i = 0; i < n; i++)
+	{
+		const int r = firstRow - up + i;
+		uint64_t *pRow = &pScratch->rows[i * nw];
+
+		if (r >= 0 && r < pIn->height)
+			MorphRow(MASK_ROW(pIn, r), pRow, nw, pIn->width, left, right, bErode);
+		else
+			memset(pRow, 0, nw * sizeof(uint64_t));
+	}
+	for (i = 0; i < n; i++)
+	{
+		const uint64_t *pSrc = &pScratch->rows[i * nw];
+		uint64_t *pG = &pScratch->g[i * nw];
+
+		for (w = 0; w < nw; w++)
+		{
+			if (i % len == 0)
+				pG[w] = pSrc[w];
+			else
+				pG[w] = bErode ? (pG[w - nw] & pSrc[w]) : (pG[w - nw] | pSrc[w]);
+		}
+	}
+	for (i = n - 1; i >= 0; i--)
+	{
+		const uint64_t *pSrc = &pScratch->rows[i * nw];
+		uint64_t *pH = &pScratch->h[i * nw];
+
+		for (w = 0; w < nw; w++)
+		{
+			if (i % len == len - 1 || i == n - 1)
+				pH[w] = pSrc[w];
+			else
+				pH[w] = bErode ? (pH[w + nw] & pSrc[w]) : (pH[w + nw] | pSrc[w]);
+		}
+	}
+	for (i = 0; i < endRow - firstRow; i++)
+	{
+		const uint64_t *pH = &pScratch->h[i * nw];
+		const uint64_t *pG = &pScratch->g[(i + len - 1) * nw];
+		uint64_t *pDst = MASK_ROW(pOut, firstRow + i);
+
+		for (w = 0; w < nw; w++)
+			pDst[w] = bErode ? (pH[w] & pG[w]) : (pH[w] | pG[w]);
+	}
+}
+
+int MorphPasses(int op)
+{
+	switch (op)
+	{
+	case MORPH_ERODE:
+	case MORPH_DILATE:
+		return 1;
+	case MORPH_OPEN:
+	case MORPH_CLOSE:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+void MaskMorphologyPass(const struct BIT_MASK *pIn, struct BIT_MASK *pOut,
+		const struct MORPH_PARAMS *pParams, int pass, int border,
+		int firstRow, int endRow, struct MORPH_SCRATCH *pScratch)
+{
+	const int width = pParams->width, height = pParams->height;
+	bool bErode;
+
+	switch (pParams->op)
+	{
+	case MORPH_ERODE:
+		bErode = TRUE;
+		break;
+	case MORPH_DILATE:
+		bErode = FALSE;
+		break;
+	case MORPH_OPEN:
+		bErode = (pass == 0);
+		break;
+	case MORPH_CLOSE:
+		bErode = (pass != 0);
+		break;
+	default:
+		return;
+	}
+
+	if (width == 3 && height == 3)
+	{
+		if (bErode)
+			MaskErode3x3(pIn, pOut, border, firstRow, endRow);
+		else
+			MaskDilate3x3(pIn, pOut, border, firstRow, endRow);
+		return;
+	}
+	if (bErode)
+		MorphStripe(pIn, pOut, (width - 1) / 2, width / 2, (height - 1) / 2, height / 2, TRUE, firstRow, endRow, pScratch);
+	else
+		MorphStripe(pIn, pOut, width / 2, (width - 1) / 2, height / 2, (height - 1) / 2, FALSE, firstRow, endRow, pScratch);
+	MaskClearBorderRows(pOut, border, firstRow, endRow);
+}
@@ -0,0 +1,76 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file morphology.h
+ * @brief Binary morphology with rectangular structuring elements of any
+ * size on bit-packed masks.
+ *
+ * The cost per pixel does not depend on the height of the structuring
+ * element (van Herk/Gil-Werman along the columns) and grows only with the
+ * logarithm of its width (shift doubling along the rows, 64 pixels per
+ * operation).
+ *
+ * Every pass reads one mask and writes a range of rows of another, so the
+ * rows of a pass can be split into stripes processed in parallel; each
+ * stripe reads the halo rows above and below it that its rectangle
+ * reaches.
+ */
+#ifndef MORPHOLOGY_H_
+#define MORPHOLOGY_H_
+
+#include "oscar.h"
+#include "template_ipc.h"
+#include "bitmask.h"
+
+/*! @brief Number of rows of a stripe including the halo rows. */
+#define MORPH_PAD_ROWS (OSC_CAM_MAX_IMAGE_HEIGHT + MORPH_MAX_SIZE)
+
+/*! @brief Working memory of one pass over one stripe; every thread needs
+ * its own. */
+struct MORPH_SCRATCH
+{
+	/*! @brief The rows of the stripe and its halo after the horizontal
+	 * pass. */
+	uint64_t rows[MORPH_PAD_ROWS * MASK_MAX_WORDS_PER_ROW];
+	/*! @brief Prefix accumulators of the vertical pass. */
+	uint64_t g[MORPH_PAD_ROWS * MASK_MAX_WORDS_PER_ROW];
+	/*! @brief Suffix accumulators of the vertical pass. */
+	uint64_t h[MORPH_PAD_ROWS * MASK_MAX_WORDS_PER_ROW];
+};
+
+/*********************************************************************//*!
+ * @brief Number of passes of an operation of enum EnMorphOp.
+ *
+ * Erosion and dilation take one pass, opening and closing two.
+ *
+ * @param op The operation.
+ * @return 0, 1 or 2.
+ *//*********************************************************************/
+int MorphPasses(int op);
+
+/*********************************************************************//*!
+ * @brief One pass of an operation on the rows firstRow ... endRow - 1.
+ *
+ * An erosion uses the rectangle of the columns c - (width - 1) / 2 ...
+ * c + width / 2 and the rows likewise; a dilation the reflected one, so
+ * that erosion followed by dilation is a proper opening for even sizes,
+ * too. Pixels outside the image count as background and the pixels closer
+ * than 'border' to the image edge are cleared. A 3x3 rectangle uses the
+ * dedicated MaskErode3x3/MaskDilate3x3.
+ *
+ * @param pIn The mask to read.
+ * @param pOut The mask to write (must not be pIn), of the size of pIn.
+ * @param pParams Operation and size of the rectangle (1 ... MORPH_MAX_SIZE).
+ * @param pass The pass, 0 ... MorphPasses(pParams->op) - 1.
+ * @param border Width of the cleared border, at least 1.
+ * @param firstRow First row to write.
+ * @param endRow Row after the last one to write.
+ * @param pScratch Working memory of the calling thread.
+ *//*********************************************************************/
+void MaskMorphologyPass(const struct BIT_MASK *pIn, struct BIT_MASK *pOut,
+		const struct MORPH_PARAMS *pParams, int pass, int border,
+		int firstRow, int endRow, struct MORPH_SCRATCH *pScratch);
+
+#endif /*MORPHOLOGY_H_*/
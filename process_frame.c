@@ -9,11 +9,25 @@
 
 /* Definitions specific to this application. Also includes the Oscar main header file. */
 #include "template.h"
+#include "ycbcr.h"
+#include "bitmask.h"
+#include "morphology.h"
+#include "binarize.h"
+#include "regions.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "workers.h"
+#include "stagetimes.h"
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #define IMG_SIZE NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT
 
+/* number of bands of rows the image kernels are split into; more bands than
+ * workers, so that the workers can balance the load among them */
+#define NR_ROW_TILES 16
+
 const int nc = OSC_CAM_MAX_IMAGE_WIDTH;
 const int nr = OSC_CAM_MAX_IMAGE_HEIGHT;
 
@@ -28,16 +42,70 @@ const int MinArea = 500;
 /* size of centroid marker */
 const int SizeCross = 10;
 
-struct OSC_VIS_REGIONS ImgRegions;/* these contain the foreground objects */
 #if NUM_COLORS == 1
+/* with a sample step above 1 (data.frameParams.nOtsuSampleStep), the
+ * threshold in use is kept as long as the threshold of the sampled
+ * histogram differs by no more than this from it, else it is recomputed
+ * at full resolution */
+const int OtsuMaxDeviation = 4;
+
+/* the threshold is recomputed at full resolution at least every this many
+ * frames */
+const int OtsuExactPeriod = 30;
+#endif
+
+struct REGION_LIST ImgRegions;/* these contain the foreground objects */
+struct BIT_MASK FgMask;/* the foreground mask, one bit per pixel */
+struct RUN_LIST FgRuns;/* the runs of the foreground mask */
+struct BIT_MASK MorphTmp;/* intermediate mask of the morphology passes */
+struct MORPH_SCRATCH MorphScratch[MAX_WORKERS];/* one per worker */
+
+/* the runs of row tile t are collected at RUNS_STRIPE(&FgRuns, TileFirstRow[t])
+ * by whichever stage writes the final mask rows */
+uint16 TileFirstRow[NR_ROW_TILES];
+uint32 TileRuns[NR_ROW_TILES];
+
+/* a morphology pass over all row tiles */
+struct MORPH_JOB {
+	const struct BIT_MASK* pIn;
+	struct BIT_MASK* pOut;
+	int pass;
+	bool bEmitRuns;
+};
+
+/* (Cb,Cr) -> class look up table: 0 is background, i+1 is color class i of
+ * data.frameParams.colorClasses; rebuilt whenever the frame parameters
+ * mark it dirty */
+uint8 ClassTable[256][256];
+/* visualization (Cb,Cr) per class */
+uint8 ClassVis[MAX_NUM_COLOR_CLASSES + 1][2];
+
+#if NUM_COLORS == 1
+unsigned char OtsuThresholdFromHistogram(int InIndex, int Step, uint32* Hist);
 unsigned char OtsuThreshold(int InIndex);
-void Binarize(unsigned char threshold);
 #endif
-void Erode_3x3(int InIndex, int OutIndex);
-void Dilate_3x3(int InIndex, int OutIndex);
 int* DetectRegions();
 void DrawBoundingBoxes(int* color);
+#if NUM_COLORS == 3
+void ObjectColorTile(int iWorker, int iTile, void* pContext);
+#endif
+void TileRows(int iTile, int* pFirstRow, int* pEndRow);
+void BuildClassTable(void);
+int NearestColorClass(int cb, int cr);
 void ChangeDetection(void);
+void ChangeDetectionTile(int iWorker, int iTile, void* pContext);
+void Morphology(void);
+void MorphologyTile(int iWorker, int iTile, void* pContext);
+
+void SetDefaultColorClasses() {
+	//the two foreground colors the application was designed for
+	const struct COLOR_CLASS_TABLE Default = { 2, {
+			{ 128 - 12, 128 + 38, 0, RED },
+			{ 128 + 24, 128 - 17, 0, BLUE } } };
+
+	data.colorClasses = Default;
+	data.bClassTableDirty = true;
+}
 
 void ResetProcess() {
 	//called when "reset" button is pressed
@@ -49,25 +117,50 @@ void ResetProcess() {
 
 void ProcessFrame() {
 	//initialize counters
-	if (data.ipc.state.nStepCounter == 1) {
+	if (data.nStepCounter == 1) {
 		ManualThreshold = false;
 	} else {
 #if NUM_COLORS == 3 //if color is used, the image threshold is stored in index1
 
+		//every stage is timed from the end of the previous one
+		uint32 Lap = OscSupCycGet();
 		ChangeDetection();
+		Lap = StageTimesLap(STAGE_CHANGE_DETECTION, Lap);
+		Morphology();
+		StageTimesLap(STAGE_MORPHOLOGY, Lap);
 		int* BoxColor = DetectRegions();
+		Lap = OscSupCycGet();
 		DrawBoundingBoxes(BoxColor);
-		free(BoxColor);
 
 		char Text[] = "manual threshold";
 		DrawString(20, 20, strlen(Text), SMALL, CYAN, Text);
+		StageTimesLap(STAGE_OVERLAY, Lap);
 
 #elif NUM_COLORS == 1 //if the image is in BW, use Otsu's Method to determine the threshold
 
-		unsigned char Threshold = OtsuThreshold(SENSORIMG);
-		Binarize(Threshold);
-		Erode_3x3(THRESHOLD, INDEX0);
-		Dilate_3x3(INDEX0, THRESHOLD);
+		//every stage is timed from the end of the previous one
+		uint32 Lap = OscSupCycGet();
+		//select the threshold once per frame
+		int Threshold = ManualThreshold ?
+				data.frameParams.nThreshold : OtsuThreshold(SENSORIMG);
+		if (data.frameParams.morph.op == MORPH_NONE) {
+			//no morphology: threshold straight into the display image
+			BinarizeBytes(data.u8TempImage[SENSORIMG], nc, nr, Threshold,
+					Border, 255, data.u8TempImage[THRESHOLD]);
+			COUNT_MEM_TRAFFIC(nr * nc, nr * nc);
+			Lap = StageTimesLap(STAGE_CHANGE_DETECTION, Lap);
+		} else {
+			BinarizeMask(data.u8TempImage[SENSORIMG], nc, nr, Threshold,
+					Border, &FgMask);
+			COUNT_MEM_TRAFFIC(nr * nc, sizeof(FgMask.words));
+			Lap = StageTimesLap(STAGE_CHANGE_DETECTION, Lap);
+			//noise suppression on the bit-packed mask (opening by default)
+			Morphology();
+			//unpack for the display
+			MaskToBytes(&FgMask, data.u8TempImage[THRESHOLD], 255);
+			COUNT_MEM_TRAFFIC(sizeof(FgMask.words), nr * nc);
+			Lap = StageTimesLap(STAGE_MORPHOLOGY, Lap);
+		}
 		if (ManualThreshold) {
 			char Text[] = "manual threshold";
 			DrawString(20, 20, strlen(Text), SMALL, CYAN, Text);
@@ -75,6 +168,7 @@ void ProcessFrame() {
 			char Text[] = " Otsu's threshold";
 			DrawString(20, 20, strlen(Text), SMALL, CYAN, Text);
 		}
+		StageTimesLap(STAGE_OVERLAY, Lap);
 
 #endif
 
@@ -83,257 +177,363 @@ void ProcessFrame() {
 }
 
 #if NUM_COLORS == 1
-void Binarize(unsigned char threshold) {
-	int r, c;
-	//set result buffer to zero
-	memset(data.u8TempImage[THRESHOLD], 0, IMG_SIZE);
-
-	//loop over the rows
-	for (r = Border * nc; r < (nr - Border) * nc; r += nc) {
-		//loop over the columns
-		for (c = Border; c < (nc - Border); c++) {
-			//manual threshold?
-			if (ManualThreshold) {
-				if (data.u8TempImage[SENSORIMG][r + c]
-						< data.ipc.state.nThreshold) {
-					data.u8TempImage[THRESHOLD][r + c] = 255;
-				}
-			} else {
-				if (data.u8TempImage[SENSORIMG][r + c] < threshold) {
-					data.u8TempImage[THRESHOLD][r + c] = 255;
-				}
-			}
-		}
-	}
-}
-
-unsigned char OtsuThreshold(int InIndex) {
-	//first part: extract gray value histogram
-	unsigned int i1, best_i, K;
-	float Hist[256];
+unsigned char OtsuThresholdFromHistogram(int InIndex, int Step, uint32* Hist) {
+	//four interleaved sub-histograms, so that runs of equal gray values do
+	//not stall on incrementing the same counter over and over
+	uint32 SubHist[4][256];
+	unsigned int i1, K;
 	unsigned char* p = data.u8TempImage[InIndex];
-	float best;
-	memset(Hist, 0, sizeof(Hist));
-
-	for (i1 = 0; i1 < nr * nc; i1++) {
-		Hist[p[i1]] += 1;
+	const unsigned int n = nr * nc;
+	const unsigned int s = Step;
+	memset(SubHist, 0, sizeof(SubHist));
+
+	for (i1 = 0; i1 + 3 * s < n; i1 += 4 * s) {
+		SubHist[0][p[i1]]++;
+		SubHist[1][p[i1 + s]]++;
+		SubHist[2][p[i1 + 2 * s]]++;
+		SubHist[3][p[i1 + 3 * s]]++;
+	}
+	for (; i1 < n; i1 += s) {
+		SubHist[0][p[i1]]++;
+	}
+	for (K = 0; K < 256; K++) {
+		Hist[K] = SubHist[0][K] + SubHist[1][K] + SubHist[2][K] + SubHist[3][K];
+	}
+	COUNT_MEM_TRAFFIC((n + s - 1) / s, 0);
+
+	//determine threshold according to Otsu's method in one cumulative sweep:
+	//w0 * w1 * (mu0 - mu1)^2 = (N * S0 - w0 * S)^2 / (w0 * w1)
+	int64_t N = 0, S = 0, w0 = 0, S0 = 0;
+	double best = 0;
+	unsigned int best_i = 0;
+	for (K = 0; K < 256; K++) {
+		N += Hist[K];
+		S += (int64_t) Hist[K] * K;
 	}
-	//second part: determine threshold according to Otsu's method
-	best = 0;
-	best_i = 0;
 	for (K = 0; K < 255; K++) {
 		//the class accumulators
-		float w0 = 0, mu0 = 0, w1 = 0, mu1 = 0;
-		float bestloc;
-
-		//class 0 and 1 probabilities and averages
-		for (i1 = 0; i1 <= K; i1++) {
-			w0 += Hist[i1];
-			mu0 += (Hist[i1] * i1);
+		w0 += Hist[K];
+		S0 += (int64_t) Hist[K] * K;
+		int64_t w1 = N - w0;
+		if (w0 == 0 || w1 == 0) {
+			//one of the classes is empty
+			continue;
 		}
-		for (; i1 <= 255; i1++) {
-			w1 += Hist[i1];
-			mu1 += (Hist[i1] * i1);
-		}
-		//do normalization of average values
-		mu0 /= w0;
-		mu1 /= w1;
-
-		bestloc = w0 * w1 * (mu0 - mu1) * (mu0 - mu1);
+		double Diff = (double) (N * S0 - w0 * S);
+		double bestloc = Diff * Diff / ((double) w0 * (double) w1);
 		if (bestloc > best) {
 			best = bestloc;
 			best_i = K;
-			//OscLog(INFO, "%d %d %d %d %d\n", i1, w0, w1, mu0, mu1);
 		}
 	}
-	//OscLog(INFO, "%d %f\n", best_i, best);
 	return (unsigned char) best_i;
 }
 
+unsigned char OtsuThreshold(int InIndex) {
+	//the threshold in use, always one computed at full resolution, and the
+	//frames since it was computed
+	static int Current = -1;
+	static int FramesSinceExact;
+	const int Step = data.frameParams.nOtsuSampleStep;
+	uint32 Hist[256];
+
+	if (Step > 1 && Current >= 0 && FramesSinceExact < OtsuExactPeriod) {
+		//a threshold estimated from every Step-th pixel only, close to the
+		//one in use, confirms it; a drift away from it is recomputed
+		int Sampled = OtsuThresholdFromHistogram(InIndex, Step, Hist);
+		if (abs(Sampled - Current) <= OtsuMaxDeviation) {
+			FramesSinceExact++;
+			return (unsigned char) Current;
+		}
+	}
+	Current = OtsuThresholdFromHistogram(InIndex, 1, Hist);
+	FramesSinceExact = 0;
+	return (unsigned char) Current;
+}
+
 #endif
 
-void Erode_3x3(int InIndex, int OutIndex) {
-	int c, r;
+void Morphology() {
+	//erode or dilate: one pass, open or close: two passes
+	const int nPasses = MorphPasses(data.frameParams.morph.op);
+	struct MORPH_JOB Job;
+	int pass;
 
-	for (r = Border * nc; r < (nr - Border) * nc; r += nc) {
-		for (c = Border; c < (nc - Border); c++) {
-			unsigned char* p = &data.u8TempImage[InIndex][r + c];
-			data.u8TempImage[OutIndex][r + c] = *(p - nc - 1) & *(p - nc)
-					& *(p - nc + 1) & *(p - 1) & *p & *(p + 1) & *(p + nc - 1)
-					& *(p + nc) & *(p + nc + 1);
-		}
+	if (nPasses == 0) {
+		return;
+	}
+	//a pass reads one mask and writes the other, the last one FgMask
+	MaskInit(&MorphTmp, nc, nr);
+	if (nPasses == 1) {
+		memcpy(MorphTmp.words, FgMask.words, sizeof(FgMask.words));
+		COUNT_MEM_TRAFFIC(sizeof(FgMask.words), sizeof(FgMask.words));
+	}
+	for (pass = 0; pass < nPasses; pass++) {
+		const bool bLast = (pass == nPasses - 1);
+		Job.pIn = bLast ? &MorphTmp : &FgMask;
+		Job.pOut = bLast ? &FgMask : &MorphTmp;
+		Job.pass = pass;
+		//only color mode labels the objects
+		Job.bEmitRuns = bLast && NUM_COLORS == 3;
+		//the tiles of one pass have to be done before the next pass reads
+		//their rows as halo
+		WorkersRunTiles(NR_ROW_TILES, MorphologyTile, &Job);
+		COUNT_MEM_TRAFFIC(sizeof(FgMask.words), sizeof(FgMask.words));
 	}
 }
 
-void Dilate_3x3(int InIndex, int OutIndex) {
-	int c, r;
+void MorphologyTile(int iWorker, int iTile, void* pContext) {
+	const struct MORPH_JOB* pJob = (const struct MORPH_JOB*) pContext;
+	int firstRow, endRow;
+
+	TileRows(iTile, &firstRow, &endRow);
+	MaskMorphologyPass(pJob->pIn, pJob->pOut, &data.frameParams.morph,
+			pJob->pass, Border, firstRow, endRow, &MorphScratch[iWorker]);
+	if (pJob->bEmitRuns) {
+		//the runs of the final rows, while they are still in the cache
+		TileFirstRow[iTile] = firstRow;
+		TileRuns[iTile] = RunsFromMask(pJob->pOut, firstRow, endRow,
+				RUNS_STRIPE(&FgRuns, firstRow));
+	}
+}
 
-	for (r = Border * nc; r < (nr - Border) * nc; r += nc) {
-		for (c = Border; c < (nc - Border); c++) {
-			unsigned char* p = &data.u8TempImage[InIndex][r + c];
-			data.u8TempImage[OutIndex][r + c] = *(p - nc - 1) | *(p - nc)
-					| *(p - nc + 1) | *(p - 1) | *p | *(p + 1) | *(p + nc - 1)
-					| *(p + nc) | *(p + nc + 1);
+void TileRows(int iTile, int* pFirstRow, int* pEndRow) {
+	*pFirstRow = nr * iTile / NR_ROW_TILES;
+	*pEndRow = nr * (iTile + 1) / NR_ROW_TILES;
+}
+
+#if NUM_COLORS == 3
+/* color statistics of an object */
+struct OBJECT_COLOR {
+	uint32 sumCb, sumCr;
+	/* number of pixels per class of ClassTable, 0 is background */
+	uint32 classCount[MAX_NUM_COLOR_CLASSES + 1];
+	/* the color class assigned to the object */
+	int cls;
+};
+struct OBJECT_COLOR ObjColor[REGIONS_MAX_OBJECTS];
+
+/* one tile per object: the cost is proportional to the object's area, so
+ * the workers balance it by stealing */
+void ObjectColorTile(int iWorker, int iTile, void* pContext) {
+	int* boxColor = (int*) pContext;
+	struct OBJECT_COLOR* pColor = &ObjColor[iTile];
+	const uint32 Area = ImgRegions.objects[iTile].area;
+	uint32 currentRun = ImgRegions.objects[iTile].root;
+	uint32 MaxCount = 0;
+	int c, k;
+
+	memset(pColor, 0, sizeof(*pColor));
+	//loop over the runs of the object
+	do {
+		const struct RUN* pRun = &FgRuns.runs[currentRun];
+		const uint8* pYCbCr = &data.u8TempImage[THRESHOLD][pRun->row * nc
+				* NUM_COLORS];
+		for (c = pRun->startColumn; c <= pRun->endColumn; c++) {
+			uint8 cb = pYCbCr[c * NUM_COLORS + 1], cr = pYCbCr[c * NUM_COLORS + 2];
+			pColor->sumCb += cb;
+			pColor->sumCr += cr;
+			pColor->classCount[ClassTable[cb][cr]]++;
 		}
+		currentRun = pRun->next;
+	} while (currentRun != REGIONS_NO_RUN);
+
+	//the class with the most pixels decides the color
+	pColor->cls = -1;
+	for (k = 0; k < data.frameParams.colorClasses.nClasses; k++) {
+		if (pColor->classCount[k + 1] > MaxCount) {
+			MaxCount = pColor->classCount[k + 1];
+			pColor->cls = k;
+		}
+	}
+	//no classified pixel (e.g. after a dilation): the class nearest to the
+	//mean (Cb,Cr) of the object
+	if (pColor->cls < 0) {
+		pColor->cls = NearestColorClass(pColor->sumCb / Area,
+				pColor->sumCr / Area);
 	}
+	boxColor[iTile] = data.frameParams.colorClasses.classes[pColor->cls].color;
 }
+#endif
 
 int* DetectRegions() {
-	struct OSC_PICTURE Pic;
-	int i;
-	//set pixel value to 1 in INDEX0 because the image MUST be binary (i.e. values of 0 and 1)
-	for (i = 0; i < IMG_SIZE; i++) {
-		data.u8TempImage[INDEX0][i] = data.u8TempImage[INDEX1][i] ? 1 : 0;
-	}
+	uint32 Lap = OscSupCycGet();
+	//collect the runs of the row tiles into one list, the labeling merges
+	//the objects crossing tile boundaries
+	RunsGather(&FgRuns, NR_ROW_TILES, TileFirstRow, TileRuns);
+	COUNT_MEM_TRAFFIC(FgRuns.nRuns * sizeof(struct RUN),
+			FgRuns.nRuns * sizeof(struct RUN));
 
-	//wrap image INDEX0 in picture struct
-	Pic.data = data.u8TempImage[INDEX0];
-	Pic.width = nc;
-	Pic.height = nr;
-	Pic.type = OSC_PICTURE_BINARY;
-
-	//now do region labeling and feature extraction
-	OscVisLabelBinary(&Pic, &ImgRegions);
-	OscVisGetRegionProperties(&ImgRegions);
 #if NUM_COLORS == 3
-	unsigned int Hist[NUM_CHROM][256];
-	unsigned int best[NUM_CHROM];
-	unsigned int bestIndex[NUM_CHROM];
-	int* boxColor = (int *) malloc(sizeof(int) * (ImgRegions.noOfObjects + 1));
-	memset(boxColor, 0, sizeof(sizeof(int) * ImgRegions.noOfObjects + 1));
+	//now do region labeling and feature extraction on the runs; objects up
+	//to MinArea pixels are dropped before their colors are looked at
+	LabelRuns(&FgRuns, MinArea + 1, &ImgRegions);
+	COUNT_MEM_TRAFFIC(FgRuns.nRuns * sizeof(struct RUN),
+			FgRuns.nRuns * sizeof(struct RUN));
+	Lap = StageTimesLap(STAGE_LABELING, Lap);
+	//scratch memory of this frame; the arena is reset at the start of the
+	//next frame (FrameArenaReset in ProcessFrameBuffer)
+	int* boxColor = (int *) FrameAlloc(sizeof(int) * (ImgRegions.noOfObjects + 1));
 	if (boxColor == NULL) {
 		return 0;
 	}
-	//loop over objects
+	memset(boxColor, 0, sizeof(int) * (ImgRegions.noOfObjects + 1));
+	//the color statistics of the objects, in parallel
+	WorkersRunTiles(ImgRegions.noOfObjects, ObjectColorTile, boxColor);
 	for (int o = 0; o < ImgRegions.noOfObjects; o++) {
-		//get pointer to root run of current object
-		struct OSC_VIS_REGIONS_RUN* currentRun = ImgRegions.objects[o].root;
-		//loop over runs of current object
-		memset(Hist, 0, sizeof(Hist));
-		memset(best, 0, sizeof(best));
-		memset(bestIndex, 0, sizeof(bestIndex));
-		do {
-			//loop over pixel of current run
-			for (int c = currentRun->startColumn; c <= currentRun->endColumn;
-					c++) {
-				int r = currentRun->row;
-				//loop over color planes of pixel
-				for (int p = 0; p < NUM_CHROM; p++) {
-					//Do as Histogram for cb and cr values
-					int HistIndex = data.u8TempImage[THRESHOLD][(r * nc + c)
-							* NUM_COLORS + p + 1]; //+1 to ignore y
-					Hist[p][HistIndex] += 1; //increment the histogram at the corresponding cb, cr value
-
-					//check if current histogram position is bigger than the max value
-					if (Hist[p][HistIndex] > best[p]) {
-						//new max value found!
-						//set best to current histogram value and store the index
-						best[p] = Hist[p][HistIndex];
-						bestIndex[p] = HistIndex;
-					}
-				}
-			}
-			currentRun = currentRun->next;
-		} while (currentRun != NULL);
-		//is cr value greater than zero? (greater than 128), if true assume RED object
-		(bestIndex[1] > 128) ? (*(boxColor + o) = RED) : (*(boxColor + o) = BLUE);
-		//write current object to console
-		printf("Cb value for object %d is %d\n", o, bestIndex[0]);
-		printf("Cr value for object %d is %d\n", o, bestIndex[1]);
-		if (*(boxColor + o) == RED) {
-			printf("color of object %d is RED\n", o);
-		} else {
-			printf("color of object %d is BLUE\n", o);
-		}
+		const struct OBJECT_COLOR* pColor = &ObjColor[o];
+		const uint32 Area = ImgRegions.objects[o].area;
+		int MeanCb = pColor->sumCb / Area, MeanCr = pColor->sumCr / Area;
+		int cls = pColor->cls;
+		COUNT_MEM_TRAFFIC(NUM_CHROM * Area, 0);
+		//hand the object to the telemetry drainer, never blocks
+		const struct REGION* pObj = &ImgRegions.objects[o];
+		const struct DETECTION_RECORD Record = { data.nStepCounter,
+				o, ImgRegions.noOfObjects, pObj->bboxLeft, pObj->bboxTop,
+				pObj->bboxRight, pObj->bboxBottom, pObj->centroidX,
+				pObj->centroidY, MeanCb, MeanCr, cls, *(boxColor + o) };
+		TelemetryPush(&Record);
 	}
-	//clear console screen, only valid on POSIX
-	printf("\e[1;1H\e[2J");
+	StageTimesLap(STAGE_COLOR_ANALYSIS, Lap);
 	return boxColor;
 #elif NUM_COLORS == 1
+	LabelRuns(&FgRuns, MinArea + 1, &ImgRegions);
+	COUNT_MEM_TRAFFIC(FgRuns.nRuns * sizeof(struct RUN),
+			FgRuns.nRuns * sizeof(struct RUN));
+	StageTimesLap(STAGE_LABELING, Lap);
 	return 0;
 #endif
 }
 void DrawBoundingBoxes(int* color) {
 	uint16 o;
+	//only objects larger than MinArea are labeled
 	for (o = 0; o < ImgRegions.noOfObjects; o++) {
 		int currentColor = *(color + o);
-		if (ImgRegions.objects[o].area > MinArea) {
-			DrawBoundingBox(ImgRegions.objects[o].bboxLeft,
-					ImgRegions.objects[o].bboxTop,
-					ImgRegions.objects[o].bboxRight,
-					ImgRegions.objects[o].bboxBottom, false, currentColor);
-
-			DrawLine(ImgRegions.objects[o].centroidX - SizeCross,
-					ImgRegions.objects[o].centroidY,
-					ImgRegions.objects[o].centroidX + SizeCross,
-					ImgRegions.objects[o].centroidY, currentColor);
-			DrawLine(ImgRegions.objects[o].centroidX,
-					ImgRegions.objects[o].centroidY - SizeCross,
-					ImgRegions.objects[o].centroidX,
-					ImgRegions.objects[o].centroidY + SizeCross, currentColor);
+		DrawBoundingBox(ImgRegions.objects[o].bboxLeft,
+				ImgRegions.objects[o].bboxTop,
+				ImgRegions.objects[o].bboxRight,
+				ImgRegions.objects[o].bboxBottom, false, currentColor);
+
+		DrawLine(ImgRegions.objects[o].centroidX - SizeCross,
+				ImgRegions.objects[o].centroidY,
+				ImgRegions.objects[o].centroidX + SizeCross,
+				ImgRegions.objects[o].centroidY, currentColor);
+		DrawLine(ImgRegions.objects[o].centroidX,
+				ImgRegions.objects[o].centroidY - SizeCross,
+				ImgRegions.objects[o].centroidX,
+				ImgRegions.objects[o].centroidY + SizeCross, currentColor);
+	}
+}
+
+int NearestColorClass(int cb, int cr) {
+	const struct COLOR_CLASS_TABLE* pTable = &data.frameParams.colorClasses;
+	int MinDif = 1 << 30;
+	int MinInd = 0;
+	int frg;
+
+	for (frg = 0; frg < pTable->nClasses; frg++) {
+		int Dif = abs(cb - (int) pTable->classes[frg].cb)
+				+ abs(cr - (int) pTable->classes[frg].cr);
+		//see if the difference is smaller than the current minimum difference
+		if (Dif < MinDif) {
+			MinDif = Dif;
+			MinInd = frg;
 		}
 	}
+	return MinInd;
 }
 
-void ChangeDetection() {
-#define NumFgrCol 2
+void BuildClassTable() {
+	const struct COLOR_CLASS_TABLE* pTable = &data.frameParams.colorClasses;
+	int cb, cr, frg;
+
+	//loop over all possible (Cb,Cr) pairs and find the color class with the
+	//smallest L1 difference
+	for (cb = 0; cb < 256; cb++) {
+		for (cr = 0; cr < 256; cr++) {
+			uint8 cls = 0;
+			if (pTable->nClasses > 0) {
+				const struct COLOR_CLASS* pClass;
+				int Radius, Dif;
+
+				frg = NearestColorClass(cb, cr);
+				pClass = &pTable->classes[frg];
+				Dif = abs(cb - (int) pClass->cb) + abs(cr - (int) pClass->cr);
+				//a radius of 0 means the global threshold applies
+				Radius = pClass->radius ? pClass->radius : data.frameParams.nThreshold;
+				//if the difference is smaller than the radius the pair is
+				//foreground of class frg
+				if (Dif < Radius) {
+					cls = frg + 1;
+				}
+			}
+			ClassTable[cb][cr] = cls;
+		}
+	}
+	//the visualization color of each class, class 0 is background
+	memset(ClassVis, 0, sizeof(ClassVis));
+	for (frg = 0; frg < pTable->nClasses; frg++) {
+		ClassVis[frg + 1][0] = pTable->classes[frg].cb;
+		ClassVis[frg + 1][1] = pTable->classes[frg].cr;
+	}
+	data.frameParams.bClassTableDirty = false;
+}
 
-	uint8 FrgCol[NumFgrCol][2] = { { 128 - 12, 128 + 38 },
-			{ 128 + 24, 128 - 17 } };
-	int r, c, frg, p;
+void ChangeDetection() {
+	if (data.frameParams.bClassTableDirty) {
+		BuildClassTable();
+	}
 
-	memset(data.u8TempImage[INDEX0], 0, IMG_SIZE);
-	memset(data.u8TempImage[INDEX1], 0, IMG_SIZE);
-	memset(data.u8TempImage[BACKGROUND], 0, IMG_SIZE);
-	memset(data.u8TempImage[THRESHOLD], 0, IMG_SIZE);
+	//single streaming pass: every byte of THRESHOLD (YCbCr), BACKGROUND
+	//(visualization) and every bit of the foreground mask is written
+	//exactly once, so no clearing of the buffers is needed beforehand;
+	//the rows are independent and split into tiles across the workers
+	MaskInit(&FgMask, nc, nr);
+	WorkersRunTiles(NR_ROW_TILES, ChangeDetectionTile, NULL);
+	//read: SENSORIMG; written: THRESHOLD, BACKGROUND and the foreground mask
+	COUNT_MEM_TRAFFIC(IMG_SIZE, 2 * IMG_SIZE + sizeof(FgMask.words));
+}
 
+void ChangeDetectionTile(int iWorker, int iTile, void* pContext) {
+	int r, c, firstRow, endRow;
+	//without morphology the mask rows are final, so their runs are taken
+	//while the row is still in the cache
+	const bool bEmitRuns = (data.frameParams.morph.op == MORPH_NONE);
+	struct RUN* pRuns;
+
+	TileRows(iTile, &firstRow, &endRow);
+	pRuns = RUNS_STRIPE(&FgRuns, firstRow);
+	TileFirstRow[iTile] = firstRow;
+	TileRuns[iTile] = 0;
 //loop over the rows
-	for (r = 0; r < nr * nc; r += nc) {
+	for (r = firstRow * nc; r < endRow * nc; r += nc) {
+		const uint8* pYCbCr = &data.u8TempImage[THRESHOLD][r * NUM_COLORS];
+		uint64_t* pBits = MASK_ROW(&FgMask, r / nc);
+		uint64_t word = 0;
+		uint8* pVis = &data.u8TempImage[BACKGROUND][r * NUM_COLORS];
+		//convert rgb to ycbcr (integer only), we write result to THRESHOLD
+		//(order of the sensor image is actually bgr!)
+		Bgr2YCbCr(&data.pSensorImg[r * NUM_COLORS],
+				&data.u8TempImage[THRESHOLD][r * NUM_COLORS], nc);
 //loop over the columns
 		for (c = 0; c < nc; c++) {
-			//convert rgb to ycbcr
-			//get rgb values (order is actually bgr!)
-			float B_ = data.u8TempImage[SENSORIMG][(r + c) * NUM_COLORS + 0];
-			float G_ = data.u8TempImage[SENSORIMG][(r + c) * NUM_COLORS + 1];
-			float R_ = data.u8TempImage[SENSORIMG][(r + c) * NUM_COLORS + 2];
-			uint8 Y_ = (uint8) (0 + 0.299 * R_ + 0.587 * G_ + 0.114 * B_);
-			uint8 Cb_ = (uint8) (128 - 0.169 * R_ - 0.331 * G_ + 0.500 * B_);
-			uint8 Cr_ = (uint8) (128 + 0.500 * R_ - 0.419 * G_ - 0.081 * B_);
-			//we write result to ImIndex
-			data.u8TempImage[THRESHOLD][(r + c) * NUM_COLORS + 0] = Y_;
-			data.u8TempImage[THRESHOLD][(r + c) * NUM_COLORS + 1] = Cb_;
-			data.u8TempImage[THRESHOLD][(r + c) * NUM_COLORS + 2] = Cr_;
-
-			//loop over the different Frg colors and find smallest difference
-			int MinDif = 1 << 30;
-			int MinInd = 0;
-			for (frg = 0; frg < NumFgrCol; frg++) {
-				int Dif = 0;
-				//loop over the color planes (Cb,Cr) and sum up the difference, save in threshold
-				for (p = 0; p < NUM_CHROM; p++) {
-					Dif += abs(
-							(int) data.u8TempImage[THRESHOLD][(r + c)
-									* NUM_COLORS + p + 1]
-									- (int) FrgCol[frg][p]);
-				}
-				//see if the difference is smaller than the current minimum difference
-				if (Dif < MinDif) {
-					MinDif = Dif;
-					MinInd = frg;
-				}
-			}
-			//if the difference is smaller than threshold value
-			if (MinDif < data.ipc.state.nThreshold) {
-				//set pixel value to 255 in THRESHOLD image for further processing
-				//(we use only the first third of the image buffer)
-				data.u8TempImage[INDEX1][(r + c)] = 255;
-				//set pixel value to Frg color in BACKGROUND image for visualization
-				for (p = 0; p < NUM_CHROM; p++) {
-					data.u8TempImage[BACKGROUND][(r + c) * NUM_COLORS + p] =
-							FrgCol[MinInd][p];
-				}
+			//one table look up classifies the pixel by its (Cb,Cr) pair
+			uint8 cls = ClassTable[pYCbCr[c * NUM_COLORS + 1]][pYCbCr[c
+					* NUM_COLORS + 2]];
+			//set the bit in the foreground mask, 64 pixels per word
+			word |= (uint64_t) (cls != 0) << (c & 63);
+			if ((c & 63) == 63 || c == nc - 1) {
+				pBits[c >> 6] = word;
+				word = 0;
 			}
+			//set pixel value to Frg color in BACKGROUND image for visualization
+			pVis[c * NUM_COLORS + 0] = ClassVis[cls][0];
+			pVis[c * NUM_COLORS + 1] = ClassVis[cls][1];
+			pVis[c * NUM_COLORS + 2] = 0;
+		}
+		if (bEmitRuns) {
+			TileRuns[iTile] += RunsFromMaskRow(pBits, nc, r / nc,
+					pRuns + TileRuns[iTile]);
 		}
 	}
 }
-
@@ -0,0 +1,84 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file queue.c
+ * @brief Bounded lock-free single-producer single-consumer queue of frame
+ * buffer handles.
+ */
+
+#include "queue.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+OSC_ERR QueueInit(struct FRAME_QUEUE *pQueue)
+{
+	pQueue->head = 0;
+	pQueue->tail = 0;
+	pQueue->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pQueue->eventFd < 0)
+	{
+		OscLog(ERROR, "%s: Unable to create the eventfd (%d)!\n", __func__, errno);
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+void QueueDestroy(struct FRAME_QUEUE *pQueue)
+{
+	close(pQueue->eventFd);
+}
+
+OSC_ERR QueuePush(struct FRAME_QUEUE *pQueue, uint8 handle)
+{
+	const uint32 head = pQueue->head;
+	const uint64_t one = 1;
+
+	/* the consumer is done with the slots up to tail */
+	if (head - __atomic_load_n(&pQueue->tail, __ATOMIC_ACQUIRE) >= QUEUE_SIZE)
+	{
+		OscLog(ERROR, "%s: Queue full!\n", __func__);
+		return -EBUFFER_TOO_SMALL;
+	}
+	pQueue->handles[head % QUEUE_SIZE] = handle;
+	/* the handle is visible before the slot is published */
+	__atomic_store_n(&pQueue->head, head + 1, __ATOMIC_RELEASE);
+	/* only the wake-up goes through the kernel */
+	if (write(pQueue->eventFd, &one, sizeof(one)) != sizeof(one))
+	{
+		OscLog(ERROR, "%s: Unable to wake the consumer (%d)!\n", __func__, errno);
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+int QueuePop(struct FRAME_QUEUE *pQueue, uint32 timeoutMs)
+{
+	const uint32 tail = pQueue->tail;
+	struct pollfd wakeup = { .fd = pQueue->eventFd, .events = POLLIN };
+	uint64_t nWakeups;
+	int handle;
+
+	while (__atomic_load_n(&pQueue->head, __ATOMIC_ACQUIRE) == tail)
+	{
+		/* Clear the wake-ups before looking again: a handle published
+		 * after that look comes with a new one. */
+		if (read(pQueue->eventFd, &nWakeups, sizeof(nWakeups)) == sizeof(nWakeups))
+			continue;
+		if (timeoutMs == 0 || poll(&wakeup, 1, timeoutMs) <= 0)
+			return -1;
+	}
+	handle = pQueue->handles[tail % QUEUE_SIZE];
+	/* done with the slot before handing it back to the producer */
+	__atomic_store_n(&pQueue->tail, tail + 1, __ATOMIC_RELEASE);
+	return handle;
+}
+
+int QueueFd(const struct FRAME_QUEUE *pQueue)
+{
+	return pQueue->eventFd;
+}
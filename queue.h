@@ -0,0 +1,87 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file queue.h
+ * @brief Bounded lock-free single-producer single-consumer queue of frame
+ * buffer handles, connecting two stages of the frame pipeline.
+ *
+ * A handle is the index of a frame buffer. Whoever holds a handle owns
+ * the buffer: pushing it hands the buffer to the next stage, and the
+ * pushing stage must not touch it anymore.
+ *
+ * The consumer is woken through an eventfd, so a stage may also wait for
+ * a queue together with other file descriptors (see reactor.h).
+ */
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include "oscar.h"
+
+/*! @brief Number of slots of a queue, a power of two larger than the
+ * number of frame buffers. */
+#define QUEUE_SIZE 16
+
+/*! @brief A queue. The indices run freely and are taken modulo the size;
+ * head is only written by the producer, tail only by the consumer. */
+struct FRAME_QUEUE
+{
+	uint32 head;
+	uint32 tail;
+	uint8 handles[QUEUE_SIZE];
+	/*! @brief Signaled after handles were published, the consumer sleeps
+	 * on it. */
+	int eventFd;
+};
+
+/*********************************************************************//*!
+ * @brief Initialize an empty queue.
+ *
+ * @param pQueue The queue.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR QueueInit(struct FRAME_QUEUE *pQueue);
+
+/*********************************************************************//*!
+ * @brief Release the resources of a queue; no stage may use it anymore.
+ *
+ * @param pQueue The queue.
+ *//*********************************************************************/
+void QueueDestroy(struct FRAME_QUEUE *pQueue);
+
+/*********************************************************************//*!
+ * @brief Hand a frame buffer to the consuming stage (producer only).
+ *
+ * Never blocks. A queue cannot overflow as long as it holds fewer
+ * handles than there are slots, which the number of frame buffers
+ * guarantees.
+ *
+ * @param pQueue The queue.
+ * @param handle The frame buffer.
+ * @return SUCCESS or -EBUFFER_TOO_SMALL if the queue is full.
+ *//*********************************************************************/
+OSC_ERR QueuePush(struct FRAME_QUEUE *pQueue, uint8 handle);
+
+/*********************************************************************//*!
+ * @brief Take the oldest frame buffer of the queue (consumer only).
+ *
+ * A call finding the queue empty clears the eventfd, so a consumer
+ * woken by it has to pop until the queue is empty.
+ *
+ * @param pQueue The queue.
+ * @param timeoutMs Time to wait for a handle (ms), 0 to poll.
+ * @return The handle or -1 if none arrived in time.
+ *//*********************************************************************/
+int QueuePop(struct FRAME_QUEUE *pQueue, uint32 timeoutMs);
+
+/*********************************************************************//*!
+ * @brief The file descriptor which is readable while handles may be
+ * waiting (consumer only).
+ *
+ * @param pQueue The queue.
+ * @return The eventfd.
+ *//*********************************************************************/
+int QueueFd(const struct FRAME_QUEUE *pQueue);
+
+#endif /*QUEUE_H_*/
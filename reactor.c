@@ -0,0 +1,238 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file reactor.c
+ * @brief Event loop of the publish stage on top of epoll.
+ */
+
+#include "reactor.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+/*! @brief A watched file descriptor; the epoll events carry the index of
+ * its source and, in the upper half, the generation of the source. */
+struct REACTOR_SOURCE
+{
+	/*! @brief The file descriptor, -1 if the source is unused. */
+	int fd;
+	/*! @brief Counts the file descriptors the source watched, so that an
+	 * event of a removed one is not taken for one of its successors. */
+	uint32 generation;
+	REACTOR_HANDLER handler;
+	void *pContext;
+	/*! @brief The fd is a timerfd created by the reactor. */
+	bool bTimer;
+};
+
+static struct
+{
+	int epollFd;
+	struct REACTOR_SOURCE sources[MAX_REACTOR_SOURCES];
+	struct REACTOR_STATS stats;
+} Reactor = { .epollFd = -1 };
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+OSC_ERR ReactorCreate(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_REACTOR_SOURCES; i++)
+	{
+		Reactor.sources[i].fd = -1;
+	}
+	Reactor.stats.nWakeups = 0;
+	Reactor.stats.busyNs = 0;
+	Reactor.stats.idleNs = 0;
+	Reactor.epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (Reactor.epollFd < 0)
+	{
+		OscLog(ERROR, "%s: Unable to create the epoll instance (%d)!\n", __func__, errno);
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+void ReactorDestroy(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_REACTOR_SOURCES; i++)
+	{
+		if (Reactor.sources[i].fd >= 0 && Reactor.sources[i].bTimer)
+		{
+			close(Reactor.sources[i].fd);
+		}
+		Reactor.sources[i].fd = -1;
+	}
+	if (Reactor.epollFd >= 0)
+	{
+		close(Reactor.epollFd);
+		Reactor.epollFd = -1;
+	}
+}
+
+/*! @brief The source watching fd, -1 if there is none. */
+static int FindSource(int fd)
+{
+	int i;
+
+	for (i = 0; i < MAX_REACTOR_SOURCES; i++)
+	{
+		if (Reactor.sources[i].fd == fd)
+			return i;
+	}
+	return -1;
+}
+
+/*! @brief The data of the epoll events of a source. */
+static uint64_t SourceData(int iSource)
+{
+	return (uint64_t)Reactor.sources[iSource].generation << 32 | (uint32)iSource;
+}
+
+static OSC_ERR AddSource(int fd, uint32 events, REACTOR_HANDLER handler, void *pContext, bool bTimer)
+{
+	const int iSource = FindSource(-1);
+	struct epoll_event ev;
+
+	if (iSource < 0)
+	{
+		OscLog(ERROR, "%s: Too many file descriptors!\n", __func__);
+		return -EBUFFER_TOO_SMALL;
+	}
+	Reactor.sources[iSource].generation++;
+	ev.events = events;
+	ev.data.u64 = SourceData(iSource);
+	if (epoll_ctl(Reactor.epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to watch fd %d (%d)!\n", __func__, fd, errno);
+		return -EDEVICE;
+	}
+	Reactor.sources[iSource].fd = fd;
+	Reactor.sources[iSource].handler = handler;
+	Reactor.sources[iSource].pContext = pContext;
+	Reactor.sources[iSource].bTimer = bTimer;
+	return SUCCESS;
+}
+
+OSC_ERR ReactorAdd(int fd, uint32 events, REACTOR_HANDLER handler, void *pContext)
+{
+	return AddSource(fd, events, handler, pContext, FALSE);
+}
+
+OSC_ERR ReactorModify(int fd, uint32 events)
+{
+	const int iSource = FindSource(fd);
+	struct epoll_event ev;
+
+	if (iSource < 0)
+	{
+		OscLog(ERROR, "%s: fd %d is not watched!\n", __func__, fd);
+		return -EINVALID_PARAMETER;
+	}
+	ev.events = events;
+	ev.data.u64 = SourceData(iSource);
+	if (epoll_ctl(Reactor.epollFd, EPOLL_CTL_MOD, fd, &ev) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to modify fd %d (%d)!\n", __func__, fd, errno);
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+void ReactorRemove(int fd)
+{
+	const int iSource = FindSource(fd);
+
+	if (iSource < 0)
+		return;
+	epoll_ctl(Reactor.epollFd, EPOLL_CTL_DEL, fd, NULL);
+	Reactor.sources[iSource].fd = -1;
+}
+
+OSC_ERR ReactorAddTimer(uint32 periodMs, REACTOR_HANDLER handler, void *pContext)
+{
+	struct itimerspec period;
+	OSC_ERR err;
+	const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (fd < 0)
+	{
+		OscLog(ERROR, "%s: Unable to create a timer (%d)!\n", __func__, errno);
+		return -EDEVICE;
+	}
+	period.it_interval.tv_sec = periodMs / 1000;
+	period.it_interval.tv_nsec = (periodMs % 1000) * 1000000;
+	period.it_value = period.it_interval;
+	if (timerfd_settime(fd, 0, &period, NULL) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to start the timer (%d)!\n", __func__, errno);
+		close(fd);
+		return -EDEVICE;
+	}
+	err = AddSource(fd, EPOLLIN, handler, pContext, TRUE);
+	if (err != SUCCESS)
+	{
+		close(fd);
+	}
+	return err;
+}
+
+OSC_ERR ReactorRun(void)
+{
+	struct epoll_event events[MAX_REACTOR_SOURCES];
+	uint64_t t0 = NowNs(), t1;
+	int nEvents, i;
+
+	for (;;)
+	{
+		nEvents = epoll_wait(Reactor.epollFd, events, MAX_REACTOR_SOURCES, -1);
+		t1 = NowNs();
+		Reactor.stats.idleNs += t1 - t0;
+		Reactor.stats.nWakeups++;
+		if (nEvents < 0 && errno != EINTR)
+		{
+			OscLog(ERROR, "%s: epoll_wait failed (%d)!\n", __func__, errno);
+			return -EDEVICE;
+		}
+
+		for (i = 0; i < nEvents; i++)
+		{
+			struct REACTOR_SOURCE *pSource = &Reactor.sources[(uint32)events[i].data.u64];
+			OSC_ERR err;
+
+			/* removed by a handler of this wake-up, and maybe reused for
+			 * another file descriptor since */
+			if (pSource->fd < 0 || pSource->generation != (uint32)(events[i].data.u64 >> 32))
+				continue;
+			if (pSource->bTimer)
+			{
+				uint64_t nExpirations;
+
+				if (read(pSource->fd, &nExpirations, sizeof(nExpirations)) != sizeof(nExpirations))
+					continue;
+			}
+			err = pSource->handler(pSource->fd, events[i].events, pSource->pContext);
+			if (err != SUCCESS)
+				return err;
+		}
+		t0 = NowNs();
+		Reactor.stats.busyNs += t0 - t1;
+	}
+}
+
+void ReactorGetStats(struct REACTOR_STATS *pStats)
+{
+	*pStats = Reactor.stats;
+}
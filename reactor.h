@@ -0,0 +1,109 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file reactor.h
+ * @brief Event loop of the publish stage: sleeps in epoll until one of
+ * its file descriptors is ready and calls the handler registered for it.
+ *
+ * Everything the loop reacts to is a file descriptor: the sockets of the
+ * web interface, the eventfd of the queue of processed frames and
+ * timerfds for periodic work. So every event wakes the loop at once and
+ * the loop does not wake at all while nothing happens. The reactor also
+ * measures how much of the time the loop sleeps.
+ */
+#ifndef REACTOR_H_
+#define REACTOR_H_
+
+#include "oscar.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+
+/*! @brief Maximal number of file descriptors watched at once. */
+#define MAX_REACTOR_SOURCES 16
+
+/*! @brief Called when fd is ready; events are the EPOLL* flags. An error
+ * terminates ReactorRun. */
+typedef OSC_ERR (*REACTOR_HANDLER)(int fd, uint32 events, void *pContext);
+
+/*! @brief Counters of the loop since it was created. */
+struct REACTOR_STATS
+{
+	/*! @brief Number of returns from epoll_wait. */
+	uint32 nWakeups;
+	/*! @brief Time spent in the handlers (ns). */
+	uint64_t busyNs;
+	/*! @brief Time spent sleeping in epoll_wait (ns). */
+	uint64_t idleNs;
+};
+
+/*********************************************************************//*!
+ * @brief Create the epoll instance.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR ReactorCreate(void);
+
+/*********************************************************************//*!
+ * @brief Close the epoll instance and the timers; the other file
+ * descriptors belong to whoever added them.
+ *//*********************************************************************/
+void ReactorDestroy(void);
+
+/*********************************************************************//*!
+ * @brief Watch a file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param events The EPOLL* flags to wait for, 0 to only learn about
+ * errors and hang-ups for now.
+ * @param handler Called when fd is ready.
+ * @param pContext Passed to handler.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR ReactorAdd(int fd, uint32 events, REACTOR_HANDLER handler, void *pContext);
+
+/*********************************************************************//*!
+ * @brief Change the events waited for on a watched file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param events The EPOLL* flags.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR ReactorModify(int fd, uint32 events);
+
+/*********************************************************************//*!
+ * @brief Stop watching a file descriptor; must be called before it is
+ * closed. Pending events of the current wake-up are dropped, also if
+ * another file descriptor is added in its place meanwhile.
+ *
+ * @param fd The file descriptor.
+ *//*********************************************************************/
+void ReactorRemove(int fd);
+
+/*********************************************************************//*!
+ * @brief Call a handler periodically.
+ *
+ * @param periodMs The period (ms).
+ * @param handler Called with the timerfd once per period, missed periods
+ * are not caught up.
+ * @param pContext Passed to handler.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR ReactorAddTimer(uint32 periodMs, REACTOR_HANDLER handler, void *pContext);
+
+/*********************************************************************//*!
+ * @brief Dispatch events until a handler fails.
+ *
+ * @return The error of the handler.
+ *//*********************************************************************/
+OSC_ERR ReactorRun(void);
+
+/*********************************************************************//*!
+ * @brief The counters of the loop.
+ *
+ * @param pStats Receives the counters.
+ *//*********************************************************************/
+void ReactorGetStats(struct REACTOR_STATS *pStats);
+
+#endif /*REACTOR_H_*/
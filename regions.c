@@ -0,0 +1,233 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file regions.c
+ * @brief Run-length encoding of bit-packed masks and run-based connected
+ * component labeling.
+ */
+
+#include "regions.h"
+#include <string.h>
+
+/*! @brief Union-find forest over the runs; the root of a tree is always
+ * its smallest run index. */
+static uint32 Parent[REGIONS_MAX_RUNS];
+
+/*! @brief The number of pixels of the tree below each root. */
+static uint32 Area[REGIONS_MAX_RUNS];
+
+/*! @brief Per object: sums of the pixel coordinates and the last run of
+ * the chain. */
+static uint32 SumX[REGIONS_MAX_OBJECTS];
+static uint32 SumY[REGIONS_MAX_OBJECTS];
+static uint32 Tail[REGIONS_MAX_OBJECTS];
+
+/*! @brief Write a run. */
+static inline void SetRun(struct RUN *pRun, uint16 row, int start, int end)
+{
+	pRun->row = row;
+	pRun->startColumn = start;
+	pRun->endColumn = end;
+}
+
+uint32 RunsFromMaskRow(const uint64_t *pWords, uint16 width, uint16 row, struct RUN *pOut)
+{
+	const int nw = (width + 63) / 64;
+	/* first column of the run still open, -1 if none */
+	int start = -1;
+	int w, b;
+	uint32 n = 0;
+
+	for (w = 0; w < nw; w++)
+	{
+		uint64_t bits = pWords[w];
+
+		for (;;)
+		{
+			if (start < 0)
+			{
+				if (bits == 0)
+					break;
+				b = __builtin_ctzll(bits);
+				start = 64 * w + b;
+				/* fill in the bits below, the end is the first 0 from b on */
+				bits |= ((uint64_t)1 << b) - 1;
+			}
+			if (~bits == 0)
+			{
+				/* the run goes on in the next word */
+				break;
+			}
+			b = __builtin_ctzll(~bits);
+			SetRun(&pOut[n++], row, start, 64 * w + b - 1);
+			start = -1;
+			bits &= ~(uint64_t)0 << b;
+		}
+	}
+	if (start >= 0)
+	{
+		SetRun(&pOut[n++], row, start, width - 1);
+	}
+	return n;
+}
+
+uint32 RunsFromMask(const struct BIT_MASK *pMask, int firstRow, int endRow, struct RUN *pOut)
+{
+	uint32 n = 0;
+	int r;
+
+	for (r = firstRow; r < endRow; r++)
+	{
+		n += RunsFromMaskRow(MASK_ROW(pMask, r), pMask->width, r, pOut + n);
+	}
+	return n;
+}
+
+void RunsGather(struct RUN_LIST *pRuns, int nStripes, const uint16 *pFirstRows, const uint32 *pCounts)
+{
+	uint32 n = 0;
+	int s;
+
+	/* the stripes only move down, the first one stays in place */
+	for (s = 0; s < nStripes; s++)
+	{
+		const struct RUN *pSrc = RUNS_STRIPE(pRuns, pFirstRows[s]);
+
+		if (pSrc != &pRuns->runs[n])
+		{
+			memmove(&pRuns->runs[n], pSrc, pCounts[s] * sizeof(struct RUN));
+		}
+		n += pCounts[s];
+	}
+	pRuns->nRuns = n;
+}
+
+/*! @brief Root of the tree of run i, halving the path on the way. */
+static inline uint32 FindRoot(uint32 i)
+{
+	while (Parent[i] != i)
+	{
+		Parent[i] = Parent[Parent[i]];
+		i = Parent[i];
+	}
+	return i;
+}
+
+/*! @brief Merge the trees of the runs a and b. */
+static inline void Union(uint32 a, uint32 b)
+{
+	a = FindRoot(a);
+	b = FindRoot(b);
+	if (a < b)
+	{
+		Parent[b] = a;
+		Area[a] += Area[b];
+	}
+	else if (b < a)
+	{
+		Parent[a] = b;
+		Area[b] += Area[a];
+	}
+}
+
+void LabelRuns(struct RUN_LIST *pRuns, uint32 minArea, struct REGION_LIST *pRegions)
+{
+	struct RUN *runs = pRuns->runs;
+	const uint32 n = pRuns->nRuns;
+	uint32 prevBegin = 0, prevEnd = 0, cur = 0;
+	uint32 i, j, k;
+
+	/* merge the runs overlapping a run of the row above, both rows are
+	 * sorted by column so one sweep over the two rows suffices */
+	while (cur < n)
+	{
+		const uint16 row = runs[cur].row;
+		const uint32 curBegin = cur;
+
+		for (; cur < n && runs[cur].row == row; cur++)
+		{
+			Parent[cur] = cur;
+			Area[cur] = runs[cur].endColumn - runs[cur].startColumn + 1;
+		}
+		if (prevEnd > prevBegin && runs[prevBegin].row + 1 == row)
+		{
+			j = prevBegin;
+			for (i = curBegin; i < cur; i++)
+			{
+				while (j < prevEnd && runs[j].endColumn < runs[i].startColumn)
+					j++;
+				for (k = j; k < prevEnd && runs[k].startColumn <= runs[i].endColumn; k++)
+					Union(i, k);
+			}
+		}
+		prevBegin = curBegin;
+		prevEnd = cur;
+	}
+
+	/* the root of an object is its first run, so its label is known
+	 * before any other run of the object is reached */
+	pRegions->noOfObjects = 0;
+	for (i = 0; i < n; i++)
+	{
+		struct RUN *pRun = &runs[i];
+		const uint32 root = FindRoot(i);
+		const uint32 len = pRun->endColumn - pRun->startColumn + 1;
+		struct REGION *pObj;
+		uint16 label;
+
+		pRun->next = REGIONS_NO_RUN;
+		if (Area[root] < minArea)
+		{
+			pRun->label = REGIONS_NO_LABEL;
+			continue;
+		}
+		if (root == i)
+		{
+			if (pRegions->noOfObjects >= REGIONS_MAX_OBJECTS)
+			{
+				pRun->label = REGIONS_NO_LABEL;
+				continue;
+			}
+			label = pRegions->noOfObjects++;
+			pObj = &pRegions->objects[label];
+			pObj->root = i;
+			pObj->area = 0;
+			pObj->bboxLeft = pRun->startColumn;
+			pObj->bboxRight = pRun->endColumn;
+			pObj->bboxTop = pObj->bboxBottom = pRun->row;
+			SumX[label] = SumY[label] = 0;
+		}
+		else
+		{
+			label = runs[root].label;
+			if (label == REGIONS_NO_LABEL)
+			{
+				pRun->label = REGIONS_NO_LABEL;
+				continue;
+			}
+			pObj = &pRegions->objects[label];
+			runs[Tail[label]].next = i;
+			if (pRun->startColumn < pObj->bboxLeft)
+				pObj->bboxLeft = pRun->startColumn;
+			if (pRun->endColumn > pObj->bboxRight)
+				pObj->bboxRight = pRun->endColumn;
+			pObj->bboxBottom = pRun->row;
+		}
+		pRun->label = label;
+		Tail[label] = i;
+		pObj->area += len;
+		/* the sum of the columns start ... end */
+		SumX[label] += len * (pRun->startColumn + pRun->endColumn) / 2;
+		SumY[label] += len * pRun->row;
+	}
+
+	for (i = 0; i < pRegions->noOfObjects; i++)
+	{
+		struct REGION *pObj = &pRegions->objects[i];
+
+		pObj->centroidX = SumX[i] / pObj->area;
+		pObj->centroidY = SumY[i] / pObj->area;
+	}
+}
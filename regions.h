@@ -0,0 +1,139 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file regions.h
+ * @brief Run-length encoded foreground and run-based connected component
+ * labeling.
+ *
+ * The runs are emitted row by row straight from the bit-packed mask
+ * words, 64 pixels per test, so neither a byte image of the foreground nor
+ * a separate scan of it is needed. Stripes of rows can be encoded in
+ * parallel and gathered afterwards. Objects are the 4-connected components
+ * of the runs (as with OscVisLabelBinary); the labeling works on the
+ * gathered list, so objects crossing stripe boundaries are merged.
+ */
+#ifndef REGIONS_H_
+#define REGIONS_H_
+
+#include "oscar.h"
+#include "bitmask.h"
+
+/*! @brief Maximal number of runs of a row: every other pixel set. */
+#define REGIONS_MAX_RUNS_PER_ROW (OSC_CAM_MAX_IMAGE_WIDTH / 2 + 1)
+
+/*! @brief Maximal number of runs of an image. */
+#define REGIONS_MAX_RUNS (OSC_CAM_MAX_IMAGE_HEIGHT * REGIONS_MAX_RUNS_PER_ROW)
+
+/*! @brief Maximal number of kept objects; further objects are dropped. */
+#define REGIONS_MAX_OBJECTS 1000
+
+/*! @brief Label of the runs of dropped objects. */
+#define REGIONS_NO_LABEL 0xffff
+
+/*! @brief Marks the end of the run chain of an object. */
+#define REGIONS_NO_RUN 0xffffffff
+
+/*! @brief A horizontal run of foreground pixels. */
+struct RUN
+{
+	/*! @brief The row of the run. */
+	uint16 row;
+	/*! @brief The first column of the run. */
+	uint16 startColumn;
+	/*! @brief The last column of the run (inclusive). */
+	uint16 endColumn;
+	/*! @brief Index of the object the run belongs to, set by LabelRuns. */
+	uint16 label;
+	/*! @brief Index of the next run of the same object or REGIONS_NO_RUN. */
+	uint32 next;
+};
+
+/*! @brief The runs of an image, ordered by row and column. */
+struct RUN_LIST
+{
+	/*! @brief The number of runs. */
+	uint32 nRuns;
+	/*! @brief The runs. */
+	struct RUN runs[REGIONS_MAX_RUNS];
+};
+
+/*! @brief Where the runs of a stripe starting at row r are collected
+ * before RunsGather: there is room for any number of runs of the rows
+ * r ... height - 1. */
+#define RUNS_STRIPE(pRuns, r) (&(pRuns)->runs[(r) * REGIONS_MAX_RUNS_PER_ROW])
+
+/*! @brief A connected foreground object. */
+struct REGION
+{
+	/*! @brief Index of the first run of the object. */
+	uint32 root;
+	/*! @brief Number of pixels. */
+	uint32 area;
+	/*! @brief Center of mass. */
+	uint16 centroidX, centroidY;
+	/*! @brief Bounding box (inclusive). */
+	uint16 bboxLeft, bboxTop, bboxRight, bboxBottom;
+};
+
+/*! @brief The objects of an image. */
+struct REGION_LIST
+{
+	/*! @brief The number of objects. */
+	uint16 noOfObjects;
+	/*! @brief The objects. */
+	struct REGION objects[REGIONS_MAX_OBJECTS];
+};
+
+/*********************************************************************//*!
+ * @brief Write the runs of one mask row.
+ *
+ * The bits past the width must be clear.
+ *
+ * @param pWords The words of the mask row.
+ * @param width Width of the row in pixels.
+ * @param row Index of the row.
+ * @param pOut Room for REGIONS_MAX_RUNS_PER_ROW runs.
+ * @return The number of runs written.
+ *//*********************************************************************/
+uint32 RunsFromMaskRow(const uint64_t *pWords, uint16 width, uint16 row, struct RUN *pOut);
+
+/*********************************************************************//*!
+ * @brief Write the runs of the rows firstRow ... endRow - 1 of a mask.
+ *
+ * @param pMask The mask.
+ * @param firstRow First row.
+ * @param endRow Row after the last one.
+ * @param pOut Room for the runs, e.g. RUNS_STRIPE(pRuns, firstRow).
+ * @return The number of runs written.
+ *//*********************************************************************/
+uint32 RunsFromMask(const struct BIT_MASK *pMask, int firstRow, int endRow, struct RUN *pOut);
+
+/*********************************************************************//*!
+ * @brief Move the runs of consecutive stripes, collected at
+ * RUNS_STRIPE(pRuns, firstRow) each, together into one list.
+ *
+ * @param pRuns The run list.
+ * @param nStripes The number of stripes.
+ * @param pFirstRows The first row of every stripe, increasing.
+ * @param pCounts The number of runs of every stripe.
+ *//*********************************************************************/
+void RunsGather(struct RUN_LIST *pRuns, int nStripes, const uint16 *pFirstRows, const uint32 *pCounts);
+
+/*********************************************************************//*!
+ * @brief Group the runs into 4-connected objects and compute their area,
+ * centroid and bounding box.
+ *
+ * The areas are known once the runs are grouped, so objects smaller than
+ * minArea are dropped (their runs get REGIONS_NO_LABEL) before any other
+ * work is spent on them. Sets the label of every run and chains the runs
+ * of each object in row order, starting at the root of the object.
+ *
+ * @param pRuns The run list.
+ * @param minArea Minimal number of pixels of an object.
+ * @param pRegions The objects found.
+ *//*********************************************************************/
+void LabelRuns(struct RUN_LIST *pRuns, uint32 minArea, struct REGION_LIST *pRegions);
+
+#endif /*REGIONS_H_*/
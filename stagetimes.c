@@ -0,0 +1,114 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file stagetimes.c
+ * @brief Latency histograms of the stages of a frame.
+ */
+
+#include "stagetimes.h"
+#include "trace.h"
+
+/*! @brief Latencies of at least 2^MAX_OCTAVE us go to the last bucket. */
+#define MAX_OCTAVE 26
+
+/*! @brief The histograms; a histogram is only written by the thread of
+ * its stage, the others read it while it is written. The number of
+ * samples and the percentiles are only filled in for the readers. */
+static struct STAGE_HISTOGRAM Stages[NR_STAGES];
+
+/*! @brief The names of the stages in the trace. */
+static const char * const StageNames[NR_STAGES] = {
+	"Capture wait", "Sensor image", "Change detection", "Morphology",
+	"Labeling", "Color analysis", "Overlay", "Publish"
+};
+
+/*! @brief The bucket of a latency. */
+static int Bucket(uint32 us)
+{
+	int octave = 31 - __builtin_clz(us | 1);
+
+	if (us < 4)
+		return us;
+	if (octave >= MAX_OCTAVE)
+		return NR_LATENCY_BUCKETS - 1;
+	/* the two bits after the leading one select the quarter */
+	return 4 + (octave - 2) * 4 + ((us >> (octave - 2)) & 3);
+}
+
+/*! @brief The largest latency of a bucket. */
+static uint32 BucketMax(int bucket)
+{
+	int octave = (bucket - 4) / 4 + 2;
+
+	if (bucket < 4)
+		return bucket;
+	return ((5 + (bucket - 4) % 4) << (octave - 2)) - 1;
+}
+
+/*! @brief The latency below which the given share of the samples fall,
+ * from the bucket it falls in; at most the largest latency. */
+static uint32 Percentile(const struct STAGE_HISTOGRAM *pHist, uint32 percent)
+{
+	const uint32 rank = ((uint64_t)pHist->nSamples * percent + 99) / 100;
+	uint32 sum = 0;
+	int b;
+
+	if (pHist->nSamples == 0)
+		return 0;
+	for (b = 0; b < NR_LATENCY_BUCKETS - 1; b++)
+	{
+		sum += pHist->counts[b];
+		if (sum >= rank)
+			break;
+	}
+	return BucketMax(b) < pHist->maxUs ? BucketMax(b) : pHist->maxUs;
+}
+
+uint32 StageTimesLap(int stage, uint32 startCyc)
+{
+	const uint32 now = OscSupCycGet();
+	/* the difference is right across a wrap of the counter */
+	const uint32 us = OscSupCycToMicroSecs(now - startCyc);
+
+	StageTimesRecord(stage, us);
+	TraceSpan(StageNames[stage], stage, us);
+	return now;
+}
+
+void StageTimesRecord(int stage, uint32 us)
+{
+	struct STAGE_HISTOGRAM *pHist = &Stages[stage];
+	const int b = Bucket(us);
+
+	/* single writer: plain increments, stored so readers see whole values */
+	__atomic_store_n(&pHist->counts[b], pHist->counts[b] + 1, __ATOMIC_RELAXED);
+	if (us > pHist->maxUs)
+	{
+		__atomic_store_n(&pHist->maxUs, us, __ATOMIC_RELAXED);
+	}
+}
+
+void StageTimesGet(struct STAGE_TIMES *pTimes)
+{
+	int s, b;
+
+	for (s = 0; s < NR_STAGES; s++)
+	{
+		struct STAGE_HISTOGRAM *pHist = &pTimes->stages[s];
+
+		/* the samples are counted from the buckets read, so that the
+		 * percentiles are consistent even while the stage records */
+		pHist->nSamples = 0;
+		for (b = 0; b < NR_LATENCY_BUCKETS; b++)
+		{
+			pHist->counts[b] = __atomic_load_n(&Stages[s].counts[b], __ATOMIC_RELAXED);
+			pHist->nSamples += pHist->counts[b];
+		}
+		pHist->maxUs = __atomic_load_n(&Stages[s].maxUs, __ATOMIC_RELAXED);
+		pHist->p50Us = Percentile(pHist, 50);
+		pHist->p95Us = Percentile(pHist, 95);
+		pHist->p99Us = Percentile(pHist, 99);
+	}
+}
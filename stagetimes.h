@@ -0,0 +1,46 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file stagetimes.h
+ * @brief Latency histograms of the stages of a frame (enum EnStage).
+ *
+ * The stages are timed with the cycle counter and the latencies sorted
+ * into log-scale buckets: four per power of two, so a percentile read
+ * from the buckets is off by less than a quarter. Every stage is recorded
+ * by one thread only, any thread may read the histograms while the
+ * application runs.
+ */
+#ifndef STAGETIMES_H_
+#define STAGETIMES_H_
+
+#include "oscar.h"
+#include "template_ipc.h"
+
+/*********************************************************************//*!
+ * @brief Record the latency of a stage which started at startCyc and ends
+ * now, and the stage as a span of the trace.
+ *
+ * @param stage The stage (enum EnStage).
+ * @param startCyc OscSupCycGet() at the start of the stage.
+ * @return OscSupCycGet() now, the start of a stage following right away.
+ *//*********************************************************************/
+uint32 StageTimesLap(int stage, uint32 startCyc);
+
+/*********************************************************************//*!
+ * @brief Record a latency of a stage.
+ *
+ * @param stage The stage (enum EnStage).
+ * @param us The latency (us).
+ *//*********************************************************************/
+void StageTimesRecord(int stage, uint32 us);
+
+/*********************************************************************//*!
+ * @brief The histograms of all stages with their percentiles.
+ *
+ * @param pTimes Receives the histograms.
+ *//*********************************************************************/
+void StageTimesGet(struct STAGE_TIMES *pTimes);
+
+#endif /*STAGETIMES_H_*/
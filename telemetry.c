@@ -0,0 +1,132 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file telemetry.c
+ * @brief Single-producer single-consumer ring of detection records and
+ * the thread draining it to a file.
+ */
+
+#include "telemetry.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/*! @brief The ring. The indices run freely and are taken modulo the size;
+ * head is only written by the producer, tail only by the consumer. */
+static struct
+{
+	volatile uint32 head;
+	volatile uint32 tail;
+	/*! @brief Records dropped because the ring was full (producer). */
+	volatile uint32 nDropped;
+	struct DETECTION_RECORD records[TELEMETRY_RING_SIZE];
+} Ring;
+
+static FILE *pTelemetryFile;
+static pthread_t DrainThread;
+static volatile bool bDraining;
+
+bool TelemetryPush(const struct DETECTION_RECORD *pRecord)
+{
+	const uint32 head = Ring.head;
+
+	/* telemetry disabled */
+	if (pTelemetryFile == NULL)
+		return FALSE;
+	if (head - Ring.tail >= TELEMETRY_RING_SIZE)
+	{
+		Ring.nDropped++;
+		return FALSE;
+	}
+	Ring.records[head % TELEMETRY_RING_SIZE] = *pRecord;
+	/* the record has to be visible before the slot is published */
+	__sync_synchronize();
+	Ring.head = head + 1;
+	return TRUE;
+}
+
+/*! @brief Write up to maxRecords records to the file; returns the number
+ * written. */
+static uint32 Drain(uint32 maxRecords)
+{
+	static uint32 nDroppedReported;
+	const uint32 head = Ring.head;
+	uint32 tail = Ring.tail;
+	uint32 n = 0, nDropped;
+
+	/* read the records only after their slots were published */
+	__sync_synchronize();
+	for (; tail != head && n < maxRecords; tail++, n++)
+	{
+		const struct DETECTION_RECORD *p = &Ring.records[tail % TELEMETRY_RING_SIZE];
+
+		fprintf(pTelemetryFile, "frame %u object %u/%u bbox %u %u %u %u centroid %u %u cb %u cr %u class %u color %u\n",
+				(unsigned int)p->frameId, p->objectId, p->nObjects,
+				p->bboxLeft, p->bboxTop, p->bboxRight, p->bboxBottom,
+				p->centroidX, p->centroidY, p->cb, p->cr, p->colorClass, p->color);
+	}
+	/* done with the slots before handing them back to the producer */
+	__sync_synchronize();
+	Ring.tail = tail;
+
+	nDropped = Ring.nDropped;
+	if (nDropped != nDroppedReported)
+	{
+		fprintf(pTelemetryFile, "dropped %u records\n", (unsigned int)(nDropped - nDroppedReported));
+		nDroppedReported = nDropped;
+	}
+	if (n > 0)
+	{
+		fflush(pTelemetryFile);
+	}
+	return n;
+}
+
+static void *DrainLoop(void *pArg)
+{
+	const struct timespec period = {
+		TELEMETRY_DRAIN_PERIOD_MS / 1000,
+		(TELEMETRY_DRAIN_PERIOD_MS % 1000) * 1000000 };
+
+	while (bDraining)
+	{
+		nanosleep(&period, NULL);
+		Drain(TELEMETRY_MAX_RECORDS_PER_DRAIN);
+	}
+	return NULL;
+}
+
+OSC_ERR TelemetryStart(const char *strFileName)
+{
+	pTelemetryFile = fopen(strFileName, "a");
+	if (pTelemetryFile == NULL)
+	{
+		OscLog(ERROR, "%s: Unable to open %s!\n", __func__, strFileName);
+		return -EUNABLE_TO_OPEN_FILE;
+	}
+	bDraining = TRUE;
+	if (pthread_create(&DrainThread, NULL, DrainLoop, NULL) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to start the drainer!\n", __func__);
+		bDraining = FALSE;
+		fclose(pTelemetryFile);
+		pTelemetryFile = NULL;
+		return -EDEVICE;
+	}
+	return SUCCESS;
+}
+
+void TelemetryStop(void)
+{
+	if (pTelemetryFile == NULL)
+		return;
+
+	bDraining = FALSE;
+	pthread_join(DrainThread, NULL);
+	/* the producer is done, write the rest without rate limit */
+	Drain(TELEMETRY_RING_SIZE);
+	fclose(pTelemetryFile);
+	pTelemetryFile = NULL;
+}
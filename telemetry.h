@@ -0,0 +1,76 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file telemetry.h
+ * @brief Detection records passed from the frame loop to a background
+ * thread writing them to a file.
+ *
+ * The frame loop is the only producer and the drainer thread the only
+ * consumer of a fixed-size ring, so neither side needs a lock. Pushing a
+ * record never blocks: if the ring is full, the record is dropped and
+ * counted.
+ */
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "oscar.h"
+
+/*! @brief Number of records the ring holds, a power of two. */
+#define TELEMETRY_RING_SIZE 1024
+
+/*! @brief Period (ms) at which the drainer empties the ring. */
+#define TELEMETRY_DRAIN_PERIOD_MS 100
+
+/*! @brief Maximal number of records written per period, which bounds the
+ * I/O rate of the drainer. */
+#define TELEMETRY_MAX_RECORDS_PER_DRAIN 256
+
+/*! @brief One detected object of one frame. */
+struct DETECTION_RECORD
+{
+	/*! @brief The frame (step counter) the object was found in. */
+	uint32 frameId;
+	/*! @brief Index of the object within the frame. */
+	uint16 objectId;
+	/*! @brief Number of objects of the frame. */
+	uint16 nObjects;
+	/*! @brief Bounding box (inclusive). */
+	uint16 bboxLeft, bboxTop, bboxRight, bboxBottom;
+	/*! @brief Center of mass. */
+	uint16 centroidX, centroidY;
+	/*! @brief Mean chroma of the object. */
+	uint8 cb, cr;
+	/*! @brief The color class assigned to the object. */
+	uint8 colorClass;
+	/*! @brief The drawing color of that class (enum ObjColor). */
+	uint8 color;
+};
+
+/*********************************************************************//*!
+ * @brief Open the output file and start the drainer thread.
+ *
+ * @param strFileName The file the records are appended to.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR TelemetryStart(const char *strFileName);
+
+/*********************************************************************//*!
+ * @brief Stop the drainer thread after writing the remaining records and
+ * close the output file.
+ *//*********************************************************************/
+void TelemetryStop(void);
+
+/*********************************************************************//*!
+ * @brief Append a record to the ring; never blocks.
+ *
+ * Must only be called from one thread (the frame loop).
+ *
+ * @param pRecord The record, copied into the ring.
+ * @return FALSE if the record was dropped: the ring was full or the
+ * telemetry is not running.
+ *//*********************************************************************/
+bool TelemetryPush(const struct DETECTION_RECORD *pRecord);
+
+#endif /*TELEMETRY_H_*/
@@ -13,44 +13,163 @@
 #include "oscar.h"
 #include "debug.h"
 #include "template_ipc.h"
+#include "reactor.h"
 #include <stdio.h>
 
 /*--------------------------- Settings ------------------------------*/
-/*! @brief The number of frame buffers used. */
+/*! @brief The number of frame buffers used unless set with the -b option
+ * (2 ... MAX_FRAME_BUFFERS). */
 #define NR_FRAME_BUFFERS 3
 
+/*! @brief The number of web interface connections served at once unless
+ * set with the -c option (1 ... IPC_MAX_CLIENTS). */
+#define NR_IPC_CLIENTS 4
+
+/*! @brief The largest number of web interface connections served at
+ * once; each has a request slot. */
+#define IPC_MAX_CLIENTS 8
+
 /*! @brief Timeout (ms) when waiting for a new picture. */
 #define CAMERA_TIMEOUT 1
 
+/*! @brief Timeout (ms) after which a waiting pipeline stage checks
+ * whether it has to stop. */
+#define STAGE_TIMEOUT 100
+
+/*! @brief Period (ms) of the load statistics of the publish stage. */
+#define LOAD_STATS_PERIOD 1000
+
+/*! @brief Time (ms) after the last request of the web interface for a
+ * frame during which the frames are published in the image ring. */
+#define VIEWER_TIMEOUT 3000
+
 /*! @brief The file name of the test image on the host. */
 #define TEST_IMAGE_FN "test.bmp"
 
+/*! @brief Number of threads processing a frame (the raspi-cam has four
+ * cores). */
+#define NR_WORKERS 4
+
+/*! @brief The file the detected objects are written to. */
+#define TELEMETRY_FN "detections.log"
+
+/*! @brief Number of frames after which the frame loop must not allocate
+ * heap memory anymore (enforced in debug builds). */
+#define ALLOC_GUARD_WARMUP_FRAMES 10
+
 /*------------------- Main data object and members ------------------*/
 
-/*! @brief The different states of a pending IPC request. */
+/*! @brief The different states of the IPC request being handled. */
 enum EnIpcRequestState
 {
 	REQ_STATE_IDLE,
 	REQ_STATE_ACK_PENDING,
-	REQ_STATE_NACK_PENDING
+	REQ_STATE_NACK_PENDING,
+	/*! @brief The request is answered with the next frame
+	 * (IpcNotifyFrame). */
+	REQ_STATE_FRAME_PENDING
+};
+
+/*! @brief A request of the web interface. */
+struct IPC_REQUEST
+{
+	/*! @brief The parameter (enum EnIpcParamIds). */
+	uint32 paramID;
+	/*! @brief The value of a set request, or where to write the value of a
+	 * get request. */
+	void *pAddr;
+	/*! @brief Size of the value (bytes). */
+	uint32 length;
+	/*! @brief Size of the reply (bytes): the size asked for by a get
+	 * request, 0 for a set request; set by the handlers of the set
+	 * requests answered with a value. */
+	uint32 replyLength;
 };
 
 /*! @brief Holds all the data needed for IPC with the user interface.*/
 struct IPC_DATA
 {
-	/*! @brief ID of the IPC channel used to communicate with the
-	 * webinterface. */
-	OSC_IPC_CHAN_ID ipcChan;
-	/*! @brief An unacknowledged request. */
-	struct OSC_IPC_REQUEST req;
+	/*! @brief The request being handled; it and its reply are held in
+	 * the request slot of its connection. */
+	struct IPC_REQUEST req;
 	/*! @brief The state of above IPC request. */
 	enum EnIpcRequestState enReqState;
+	/*! @brief The image (enum IMG_TYPE) published with every frame, chosen
+	 * by the state of the state machine. */
+	unsigned int nPublishedImage;
+	/*! @brief Whether the drawing info is published with the image. */
+	bool bPublishedAddInfo;
 	
 	/*! @brief All the information requested by the web interface is gathered
 	 * here. */
 	struct APPLICATION_STATE state;
 };
 
+/*! @brief Counters of the requests answered. */
+struct IPC_STATS
+{
+	/*! @brief Number of requests. */
+	uint32 nRequests;
+	/*! @brief Total time from the request read to the reply sent (ns). */
+	uint64_t latencyNs;
+	/*! @brief The longest of these times (ns). */
+	uint32 maxLatencyNs;
+};
+
+/*! @brief Memory traffic caused by the image processing of one frame.
+ *
+ * Each kernel accounts for the bytes it streams from and to the image
+ * buffers; see COUNT_MEM_TRAFFIC. */
+struct MEM_TRAFFIC
+{
+	/*! @brief Bytes read from image buffers. */
+	uint32 nBytesRead;
+	/*! @brief Bytes written to image buffers. */
+	uint32 nBytesWritten;
+};
+
+/*! @brief The results of a frame, handed from the process to the publish
+ * stage together with the frame buffer. */
+struct FRAME_INFO
+{
+	/*! @brief The time stamp when the image was taken. */
+	uint32 imageTimeStamp;
+	/*! @brief The step counter of the frame. */
+	uint32 nStepCounter;
+	/*! @brief Memory traffic of the processing. */
+	struct MEM_TRAFFIC memTraffic;
+	/*! @brief Number of frame workers. */
+	uint8 nWorkers;
+	/*! @brief Busy time of each worker in percent of the kernel time. */
+	uint8 workerUtilization[MAX_NUM_WORKERS];
+	/*! @brief Number of tiles the workers took from each other. */
+	uint32 nTilesStolen;
+	/*! @brief The cycle counter when the processing was done. */
+	uint32 doneCyc;
+	/*! @brief The frame of the image ring the frame was published as. */
+	uint32 nImageFrame;
+};
+
+/*! @brief The parameters a frame is processed with; a snapshot of the ones
+ * set by the web interface, taken at the start of the frame. */
+struct FRAME_PARAMS
+{
+	/*! @brief cut off value for change detection.*/
+	int nThreshold;
+	/*! @brief morphology applied to the foreground mask */
+	struct MORPH_PARAMS morph;
+	/*! @brief pixel step of the sampled histogram of Otsu's threshold */
+	int nOtsuSampleStep;
+	/*! @brief the foreground color classes */
+	struct COLOR_CLASS_TABLE colorClasses;
+	/*! @brief the (Cb,Cr) classification table must be rebuilt */
+	bool bClassTableDirty;
+	/*! @brief the image published (enum IMG_TYPE) */
+	unsigned int nImage;
+	/*! @brief whether the drawing info is published with it */
+	bool bAddInfo;
+};
+
 /*! @brief list of images we require for processing; always use these indices
  * */
 enum IMG_TYPE
@@ -65,28 +184,38 @@ enum IMG_TYPE
 };
 
 
-/*! @brief The structure storing all important variables of the application.
- * */
-struct TEMPLATE
-{
-	/*! @brief The frame buffers for the frame capture device driver.*/
+/*! @brief The size of a frame buffer for the frame capture device driver. */
 #if NUM_COLORS == 1
 	#define NUMCOL_PLANES 2 /* UYVY */
-	uint8 u8FrameBuffers[NR_FRAME_BUFFERS][NUMCOL_PLANES*OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH];
 #else
 	#define NUMCOL_PLANES 3 /* RGB */
-	uint8 u8FrameBuffers[NR_FRAME_BUFFERS][NUM_COLORS*OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH];
 #endif
+#define FRAME_BUFFER_SIZE (NUMCOL_PLANES*OSC_CAM_MAX_IMAGE_HEIGHT*OSC_CAM_MAX_IMAGE_WIDTH)
+
+/*! @brief The structure storing all important variables of the application.
+ * */
+struct TEMPLATE
+{
 	/*! @brief A buffer to hold the temporary image. */
 	uint8 u8TempImage[MAX_NUM_IMG][NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT];
 	/* size of additional data buffer */
 	uint32 AddBufSize;
+	/* the step counter of the process stage */
+	uint32 nStepCounter;
+	/* the parameters of the frame being processed */
+	struct FRAME_PARAMS frameParams;
+	/* the results of the frame in each frame buffer */
+	struct FRAME_INFO frameInfo[MAX_FRAME_BUFFERS];
 	/* indicates that the shutter time changed */
 	bool nExposureTimeChanged;
 	/* indicates that the processing should be reset */
 	bool nResetProcessing;
 	/* the threshold used for processing purposes */
 	int nThreshold;
+	/* the foreground color classes */
+	struct COLOR_CLASS_TABLE colorClasses;
+	/* indicates that the (Cb,Cr) classification table must be rebuilt */
+	bool bClassTableDirty;
 	/*! @brief Handle to the framework instance. */
 	void *hFramework;
 	/*! @brief Camera-Scene perspective */
@@ -96,16 +225,32 @@ struct TEMPLATE
 	/*! @brief File name reader for camera images on the host. */
 	void *hFileNameReader;
 #endif /* OSC_HOST or OSC_SIM */
-	/*! @brief The last raw image captured. Always points to one of the frame
-	 * buffers. */
+	/*! @brief The raw image being processed. Always points to one of the
+	 * frame buffers. */
 	uint8* pCurRawImg;
+	/*! @brief The sensor image of the frame being processed. In color mode a
+	 * view onto the frame buffer itself, which the process stage holds
+	 * until the frame is processed and published; in gray mode the
+	 * debayered u8TempImage[SENSORIMG]. */
+	const uint8* pSensorImg;
 	/*! @brief All data necessary for IPC. */
 	struct IPC_DATA ipc;
+	/*! @brief Number of web interface connections served at once. */
+	int nIpcClients;
+	/*! @brief Memory traffic of the frame currently being processed. */
+	struct MEM_TRAFFIC memTraffic;
 
 };
 
 extern struct TEMPLATE data;
 
+/*! @brief Account for the memory traffic of an image processing kernel. */
+#define COUNT_MEM_TRAFFIC(read, written) \
+	do { \
+		data.memTraffic.nBytesRead += (read); \
+		data.memTraffic.nBytesWritten += (written); \
+	} while (0)
+
 /*-------------------------- Functions --------------------------------*/
 /*********************************************************************//*!
  * @brief Unload everything before exiting.
@@ -117,17 +262,55 @@ OSC_ERR Unload();
 /*********************************************************************//*!
  * @brief Give control to statemachine.
  * 
+ * Starts the acquire and the process stage of the frame pipeline in
+ * threads of their own and runs the publish stage and the IPC with the
+ * web interface in a reactor in the calling thread. The socket of the
+ * web interface is created here.
+ * 
  * @return SUCCESS or an appropriate error code otherwise
  * 
  * The function does never return normally except in error case.
  *//*********************************************************************/
 OSC_ERR StateControl(void);
 
+/*********************************************************************//*!
+ * @brief Create the socket of the web interface and watch it in the
+ * reactor.
+ * 
+ * Each connection to the socket sends a request at a time, answered
+ * before its next one is read. Up to nClients connections are served at
+ * once, each with a request slot holding its request and its reply; more
+ * wait in the backlog. The socket and the connections never block.
+ * 
+ * @param strPath The path of the socket.
+ * @param nClients Connections served at once (1 ... IPC_MAX_CLIENTS).
+ * @param handler Called by the reactor when requests were read; it is
+ * expected to call CheckIpcRequests and AckIpcRequests until there is no
+ * request left.
+ * @param pContext Passed to handler.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR IpcServerCreate(const char *strPath, int nClients, REACTOR_HANDLER handler, void *pContext);
+
+/*********************************************************************//*!
+ * @brief Close the socket of the web interface and the connections.
+ *//*********************************************************************/
+void IpcServerDestroy(void);
+
+/*********************************************************************//*!
+ * @brief The counters of the requests since the last call.
+ * 
+ * @param pStats Receives the counters, which are cleared.
+ *//*********************************************************************/
+void IpcTakeStats(struct IPC_STATS *pStats);
+
 /*********************************************************************//*!
  * @brief Handle any incoming IPC requests.
  * 
  * Check for incoming IPC requests and return the corresponding parameter
- * ID if there is a request available.
+ * ID if there is a request available. It becomes the request being
+ * handled (data.ipc.req) until it is acknowledged; the connections with a
+ * request are taken in turn.
  * 
  * @param pParamId Pointer to the variable where the parameter ID is
  * stored in case of success.
@@ -136,15 +319,30 @@ OSC_ERR StateControl(void);
 OSC_ERR CheckIpcRequests(uint32 *pParamId);
 
 /*********************************************************************//*!
- * @brief Acknowledge any pending IPC requests.
+ * @brief Acknowledge the request being handled.
  * 
- * It may take several calls to this function for an acknowledge to
- * succeed.
+ * The reply is written as far as the connection takes it without
+ * blocking; the rest follows as the connection takes it, while the other
+ * connections are served. A request waiting for a frame
+ * (REQ_STATE_FRAME_PENDING) is answered by IpcNotifyFrame instead.
  * 
  * @return SUCCESS or an appropriate error code.
  *//*********************************************************************/
 OSC_ERR AckIpcRequests();
 
+/*********************************************************************//*!
+ * @brief Answer the requests waiting for a frame.
+ * 
+ * A request acknowledged with REQ_STATE_FRAME_PENDING holds its slot
+ * without a reply until this is called; its connection is closed if the
+ * client hangs up meanwhile.
+ * 
+ * @param pValue The value of the replies.
+ * @param length Size of the value (bytes).
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR IpcNotifyFrame(const void *pValue, uint32 length);
+
 /*********************************************************************//*!
  * @brief Write an image of type fract16 to the result pointer of
  * the current request.
@@ -173,6 +371,13 @@ void ProcessFrame();
  *//*********************************************************************/
 void ResetProcess();
 
+/*********************************************************************//*!
+ * @brief Set the foreground color classes to their default values.
+ *
+ * Marks the classification table as to be rebuilt.
+ *//*********************************************************************/
+void SetDefaultColorClasses();
+
 /*********************************************************************//*!
  * @brief draw a bounding box in the camera image.
  *
@@ -20,22 +20,202 @@
 enum EnIpcParamIds
 {
 	GET_APP_STATE,
-	GET_NEW_IMG,
 	SET_IMAGE_TYPE,
 	SET_EXPOSURE_TIME,
 	SET_ADDINFO,
-	SET_THRESHOLD
+	SET_THRESHOLD,
+	SET_COLOR_CLASSES,
+	GET_COLOR_CLASSES,
+	SET_MORPHOLOGY,
+	GET_STAGE_TIMES,
+	SET_OPTIONS_GET_STATE,
+	WAIT_NEW_FRAME
 };
 
 /*! @brief The path of the unix domain socket used for IPC between the application and its user interface. */
 #define USER_INTERFACE_SOCKET_PATH "/tmp/IPCSocket.sock"
 
+/*! @brief Header of a request on the socket. A set request is followed by
+ * the new value (length bytes); a get request gives in length the size of
+ * the value it expects. The length has to be the size of the parameter.
+ * A set request is answered without a value, except SET_OPTIONS_GET_STATE
+ * (struct IPC_STATE_REPLY) and WAIT_NEW_FRAME.
+ *
+ * WAIT_NEW_FRAME gives the last frame the client has seen (uint32, as
+ * APPLICATION_STATE.nImageFrame) and is answered with the newest frame
+ * (uint32) as soon as it is another one: right away or when a frame is
+ * published; at the latest after a second, then possibly with the same
+ * frame. A client thus waits for the frames instead of polling
+ * bNewImageReady. */
+struct IPC_REQUEST_HEADER
+{
+	/*! @brief The parameter (enum EnIpcParamIds). */
+	uint32 paramID;
+	/*! @brief Nonzero for a set request. */
+	uint32 bSet;
+	/*! @brief Size of the value (bytes). */
+	uint32 length;
+};
+
+/*! @brief Header of the reply to a request; the reply to a successful get
+ * request is followed by the value (length bytes). */
+struct IPC_REPLY_HEADER
+{
+	/*! @brief SUCCESS or -ENEGATIVE_ACKNOWLEDGE. */
+	int32 err;
+	/*! @brief Size of the value (bytes). */
+	uint32 length;
+};
+
+/*! @brief The largest drawing info of an image: room for the box and the
+ * cross of a thousand objects and a few strings. */
+#define MAX_ADD_INFO_SIZE 65536
+
+/*! @brief Describes an image published by the application. It is followed
+ * by the pixels (height rows of stride bytes, channels bytes per pixel)
+ * and then by the drawing info (addInfoSize bytes), see ImageDataSize. */
+struct IMAGE_HEADER
+{
+	/*! @brief The step counter of the frame. */
+	uint32 nStepCounter;
+	/*! @brief The time stamp when the image was taken. */
+	uint32 imageTimeStamp;
+	/*! @brief The image (enum IMG_TYPE of the application). */
+	uint32 nImageType;
+	uint16 width;
+	uint16 height;
+	uint16 channels;
+	/*! @brief Bytes from one row to the next. */
+	uint16 stride;
+	/*! @brief Size of the drawing info (bytes). */
+	uint32 addInfoSize;
+};
+
+/*! @brief The largest pixels and drawing info following an image header. */
+#define IMAGE_MAX_DATA_SIZE (NUM_COLORS*OSC_CAM_MAX_IMAGE_WIDTH*OSC_CAM_MAX_IMAGE_HEIGHT + MAX_ADD_INFO_SIZE)
+
+/*! @brief The size of the pixels and the drawing info following an image
+ * header. */
+static inline uint32 ImageDataSize(const struct IMAGE_HEADER *pHeader)
+{
+	return (uint32)pHeader->stride * pHeader->height + pHeader->addInfoSize;
+}
+
+/*! @brief The POSIX shared memory object the application publishes the
+ * processed frames in (struct IMAGE_RING). */
+#define IMAGE_SHM_NAME "/template-images"
+
+/*! @brief Number of slots of the image ring: a reader has this many frames
+ * less one to read the newest slot before it is overwritten. */
+#define NR_IMAGE_SLOTS 3
+
+/*! @brief A published frame: the header, then the pixels and the drawing
+ * info in data. The slot is a seqlock: seq is odd while the slot is
+ * written, a reader takes the frame only if seq is even and unchanged
+ * after reading it (ImageSlotReadBegin, ImageSlotReadValid). */
+struct IMAGE_SLOT
+{
+	uint32 seq;
+	struct IMAGE_HEADER header;
+	uint8 data[IMAGE_MAX_DATA_SIZE];
+};
+
+/*! @brief The ring of published frames in shared memory, written by the
+ * application only. */
+struct IMAGE_RING
+{
+	/*! @brief Number of frames published; the newest is in slot
+	 * (nPublished - 1) % NR_IMAGE_SLOTS. */
+	uint32 nPublished;
+	struct IMAGE_SLOT slots[NR_IMAGE_SLOTS];
+};
+
+/*! @brief The sequence number of the slot of a frame while the slot holds
+ * it: every frame written to a slot adds 2.
+ *
+ * @param nFrame The frame, counted as IMAGE_RING.nPublished (from 1). */
+static inline uint32 ImageSlotFrameSeq(uint32 nFrame)
+{
+	return 2 * ((nFrame - 1) / NR_IMAGE_SLOTS + 1);
+}
+
+/*! @brief Start reading a slot: the sequence number to pass to
+ * ImageSlotReadValid, odd if the slot is being written. */
+static inline uint32 ImageSlotReadBegin(const struct IMAGE_SLOT *pSlot)
+{
+	return __atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE);
+}
+
+/*! @brief Whether what was read from a slot since ImageSlotReadBegin is a
+ * whole frame. */
+static inline bool ImageSlotReadValid(const struct IMAGE_SLOT *pSlot, uint32 seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (seq & 1) == 0 && __atomic_load_n(&pSlot->seq, __ATOMIC_RELAXED) == seq;
+}
+
 enum ObjType {OBJ_RECT, OBJ_LINE, OBJ_STRING};
 
 enum ObjColor {WHITE, BLACK, RED, GREEN, BLUE, YELLOW, MAGENTA, CYAN, MAX_NUM_COLORS};
 
 enum FontType {GIANT, LARGE, MEDIUMBOLD, SMALL, TINY};
 
+/*! @brief The maximum number of foreground color classes. */
+#define MAX_NUM_COLOR_CLASSES 16
+
+/*! @brief Describes a foreground color class. */
+struct COLOR_CLASS
+{
+	/*! @brief Cb value of the class center. */
+	uint8 cb;
+	/*! @brief Cr value of the class center. */
+	uint8 cr;
+	/*! @brief L1 distance in the (Cb,Cr) plane below which a pixel belongs to
+	 * the class; 0 means the global threshold (nThreshold) applies. */
+	uint8 radius;
+	/*! @brief color enum value used to draw objects of this class.*/
+	uint8 color;
+};
+
+/*! @brief The set of foreground color classes (SET_COLOR_CLASSES and
+ * GET_COLOR_CLASSES). */
+struct COLOR_CLASS_TABLE
+{
+	/*! @brief The number of valid entries in classes. */
+	uint32 nClasses;
+	/*! @brief The color classes. */
+	struct COLOR_CLASS classes[MAX_NUM_COLOR_CLASSES];
+};
+
+/*! @brief The largest width/height of the morphology rectangle. */
+#define MORPH_MAX_SIZE 63
+
+/*! @brief The morphological operations applied to the foreground mask. */
+enum EnMorphOp
+{
+	MORPH_NONE,
+	MORPH_ERODE,
+	MORPH_DILATE,
+	MORPH_OPEN,
+	MORPH_CLOSE,
+	MAX_NUM_MORPH_OPS
+};
+
+/*! @brief The morphology applied to the foreground mask (SET_MORPHOLOGY). */
+struct MORPH_PARAMS
+{
+	/*! @brief The operation, see enum EnMorphOp. */
+	int op;
+	/*! @brief Width of the rectangle (1 ... MORPH_MAX_SIZE). */
+	int width;
+	/*! @brief Height of the rectangle (1 ... MORPH_MAX_SIZE). */
+	int height;
+};
+
+/*! @brief The largest pixel step of the sampled histogram of Otsu's
+ * threshold. */
+#define OTSU_MAX_SAMPLE_STEP 64
+
 /*! @brief Describes a rectangular sub-area of an image. */
 struct IMG_RECT
 {
@@ -92,13 +272,76 @@ enum EnAppMode
 	APP_CAPTURE_ON
 };
 
+/*! @brief Maximal number of frame workers reported to the web interface. */
+#define MAX_NUM_WORKERS 8
+
+/*! @brief Maximal number of frame buffers of the camera. */
+#define MAX_FRAME_BUFFERS 8
+
+/*! @brief The states of a frame buffer, in the order a frame passes them. */
+enum EnFrameBufferState
+{
+	FRAME_BUFFER_FREE,
+	FRAME_BUFFER_CAPTURING,
+	FRAME_BUFFER_READY,
+	FRAME_BUFFER_PROCESSING,
+	FRAME_BUFFER_PUBLISHED
+};
+
+/*! @brief The timed stages of a frame, in the order a frame passes them. */
+enum EnStage
+{
+	/*! @brief From triggering the camera to the picture read. */
+	STAGE_CAPTURE_WAIT,
+	/*! @brief Debayering or copying the sensor image. */
+	STAGE_SENSOR_IMAGE,
+	STAGE_CHANGE_DETECTION,
+	STAGE_MORPHOLOGY,
+	/*! @brief Gathering the runs and labeling them. */
+	STAGE_LABELING,
+	/*! @brief Color statistics and classification of the objects. */
+	STAGE_COLOR_ANALYSIS,
+	/*! @brief Drawing info for the web interface. */
+	STAGE_OVERLAY,
+	/*! @brief From the end of the processing to the results published. */
+	STAGE_PUBLISH,
+	NR_STAGES
+};
+
+/*! @brief Number of buckets of a latency histogram: 0 ... 3 us one each,
+ * then four per power of two up to 2^26 us. */
+#define NR_LATENCY_BUCKETS 100
+
+/*! @brief The latencies of a stage since the start of the application. */
+struct STAGE_HISTOGRAM
+{
+	/*! @brief Number of samples. */
+	uint32 nSamples;
+	/*! @brief Percentiles (us): upper bounds of the buckets they fall in. */
+	uint32 p50Us, p95Us, p99Us;
+	/*! @brief The longest latency (us). */
+	uint32 maxUs;
+	/*! @brief Samples per bucket, see NR_LATENCY_BUCKETS. */
+	uint32 counts[NR_LATENCY_BUCKETS];
+};
+
+/*! @brief The latencies of all stages (GET_STAGE_TIMES). */
+struct STAGE_TIMES
+{
+	struct STAGE_HISTOGRAM stages[NR_STAGES];
+};
+
 /*! @brief Object describing all the state information the web interface needs to know about the application. */
 struct APPLICATION_STATE
 {
-	/*! @brief Whether a new image is ready to display by the web interface. */
+	/*! @brief Whether a new image is ready to display by the web interface
+	 * (WAIT_NEW_FRAME waits for it). */
 	bool bNewImageReady;
 	/*! @brief The time stamp when the last live image was taken. */
 	uint32 imageTimeStamp;
+	/*! @brief The frame of the image ring showing that image (counted as
+	 * IMAGE_RING.nPublished), 0 if none. */
+	uint32 nImageFrame;
 	/*! @brief The mode the application is running in. Depending on the mode different information may have to be displayed on the web interface.*/
 	enum EnAppMode enAppMode;
 	/*! @brief the image type index */
@@ -111,6 +354,85 @@ struct APPLICATION_STATE
 	unsigned int nStepCounter;
 	/*! @brief  additional info set from browser*/
 	int nAddInfo;
+	/*! @brief morphology applied to the foreground mask */
+	struct MORPH_PARAMS morph;
+	/*! @brief Otsu's threshold of gray images is estimated from every n-th
+	 * pixel (1 ... OTSU_MAX_SAMPLE_STEP, 1 = all). */
+	int nOtsuSampleStep;
+	/*! @brief Bytes read from image buffers while processing the last frame. */
+	uint32 nFrameBytesRead;
+	/*! @brief Bytes written to image buffers while processing the last frame. */
+	uint32 nFrameBytesWritten;
+	/*! @brief Number of frame workers. */
+	uint8 nWorkers;
+	/*! @brief Busy time of each worker in percent of the time spent in the image kernels of the last frame. */
+	uint8 workerUtilization[MAX_NUM_WORKERS];
+	/*! @brief Number of tiles the workers took from each other in the last frame. */
+	uint32 nTilesStolen;
+	/*! @brief Number of frame buffers. */
+	uint8 nFrameBuffers;
+	/*! @brief The state of each frame buffer (enum EnFrameBufferState). */
+	uint8 frameBufferState[MAX_FRAME_BUFFERS];
+	/*! @brief Number of frames captured. */
+	uint32 nFramesCaptured;
+	/*! @brief How often the camera had to wait for a free frame buffer. */
+	uint32 nCameraWaits;
+	/*! @brief Total time the camera waited for a free frame buffer (ms). */
+	uint32 cameraWaitMs;
+	/*! @brief CPU time of the application in percent of one core over the last second. */
+	uint16 cpuLoad;
+	/*! @brief Time the publish loop slept in percent of the last second. */
+	uint8 loopIdle;
+	/*! @brief Wake-ups of the publish loop in the last second. */
+	uint32 loopWakeups;
+	/*! @brief Mean time from reading a request to sending its reply in the last second (us). */
+	uint32 ipcLatencyUs;
+	/*! @brief The longest of these times (us). */
+	uint32 ipcLatencyMaxUs;
+};
+
+/*! @brief The options of a SET_OPTIONS_GET_STATE request (struct
+ * IPC_OPTIONS) which are set. */
+enum EnOptionFlags
+{
+	OPT_IMAGE_TYPE = 1 << 0,
+	OPT_EXPOSURE_TIME = 1 << 1,
+	OPT_ADDINFO = 1 << 2,
+	OPT_THRESHOLD = 1 << 3,
+	OPT_MORPH_OP = 1 << 4,
+	OPT_MORPH_WIDTH = 1 << 5,
+	OPT_MORPH_HEIGHT = 1 << 6,
+	OPT_COLOR_CLASSES = 1 << 7,
+	OPT_OTSU_SAMPLE_STEP = 1 << 8
+};
+
+/*! @brief The value of a SET_OPTIONS_GET_STATE request: options to set at
+ * once, all of them or (if one is invalid) none. */
+struct IPC_OPTIONS
+{
+	/*! @brief The options set (enum EnOptionFlags), the others are
+	 * ignored. */
+	uint32 setFlags;
+	unsigned int nImageType;
+	int nExposureTime;
+	int nAddInfo;
+	int nThreshold;
+	/*! @brief The fields set of the morphology; the others stay. */
+	struct MORPH_PARAMS morph;
+	struct COLOR_CLASS_TABLE colorClasses;
+	int nOtsuSampleStep;
 };
 
+/*! @brief The reply to SET_OPTIONS_GET_STATE: the state with the options
+ * set, with the frame it shows (nImageFrame), and the stage latencies. */
+struct IPC_STATE_REPLY
+{
+	struct APPLICATION_STATE state;
+	struct STAGE_TIMES stageTimes;
+};
+
+/*! @brief The largest value of a request or reply (the reply to
+ * SET_OPTIONS_GET_STATE); the images are read from the image ring. */
+#define IPC_MAX_VALUE_SIZE (sizeof(struct IPC_STATE_REPLY))
+
 #endif /*TEMPLATE_IPC_H_*/
@@ -0,0 +1,271 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file trace.c
+ * @brief Multi-producer ring of trace events and its output as Chrome
+ * trace-event JSON.
+ */
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+/*! @brief A begin ('B'), end ('E') or complete ('X') event. The fields
+ * are written with the slot marked as invalid (seq 0) and read back only
+ * if seq is the same before and after, so the writer never waits for the
+ * reader. */
+struct TRACE_EVENT
+{
+	/*! @brief Index of the event plus one, 0 while it is written. */
+	uint32 seq;
+	/*! @brief The time of the event (CLOCK_MONOTONIC), the begin of a
+	 * complete event. */
+	uint32 sec, nsec;
+	/*! @brief The duration of a complete event (us). */
+	uint32 durationUs;
+	const char *strName;
+	uint32 arg;
+	uint32 tid;
+	uint32 phase;
+};
+
+static struct
+{
+	/*! @brief The events, NULL if tracing is off. */
+	struct TRACE_EVENT *pEvents;
+	/*! @brief Index of the next event; runs freely, taken modulo the
+	 * size. */
+	uint32 head;
+	/*! @brief Number of threads which recorded events. */
+	uint32 nThreads;
+	/*! @brief The thread names, indexed by the trace thread ID minus one. */
+	const char *strThreadNames[TRACE_MAX_THREADS];
+	FILE *pFile;
+	int signalFd;
+} Trace = { .signalFd = -1 };
+
+/*! @brief Buffer of the trace file, so that stdio does not allocate one
+ * on the first write. fopen() still allocates the FILE itself, inside the
+ * C library where the allocation guard does not see it. */
+static char FileBuffer[BUFSIZ];
+
+/*! @brief The trace thread ID of the calling thread, 0 before its first
+ * event. */
+static __thread uint32 ThreadId;
+
+static uint32 CurrentThreadId(void)
+{
+	if (ThreadId == 0)
+	{
+		ThreadId = __atomic_add_fetch(&Trace.nThreads, 1, __ATOMIC_RELAXED);
+	}
+	return ThreadId;
+}
+
+static void Record(char phase, const char *strName, uint32 arg, uint32 durationUs)
+{
+	struct timespec ts;
+	uint32 index;
+	struct TRACE_EVENT *pEvent;
+
+	if (Trace.pEvents == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (phase == 'X')
+	{
+		/* a complete event is recorded at its end */
+		uint64_t beginNs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec - (uint64_t)durationUs * 1000;
+		ts.tv_sec = beginNs / 1000000000;
+		ts.tv_nsec = beginNs % 1000000000;
+	}
+	index = __atomic_fetch_add(&Trace.head, 1, __ATOMIC_RELAXED);
+	pEvent = &Trace.pEvents[index % TRACE_RING_SIZE];
+
+	__atomic_store_n(&pEvent->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&pEvent->sec, ts.tv_sec, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->nsec, ts.tv_nsec, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->durationUs, durationUs, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->strName, strName, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->arg, arg, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->tid, CurrentThreadId(), __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->phase, phase, __ATOMIC_RELAXED);
+	__atomic_store_n(&pEvent->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void TraceBegin(const char *strName, uint32 arg)
+{
+	Record('B', strName, arg, 0);
+}
+
+void TraceEnd(const char *strName)
+{
+	Record('E', strName, 0, 0);
+}
+
+void TraceSpan(const char *strName, uint32 arg, uint32 durationUs)
+{
+	Record('X', strName, arg, durationUs);
+}
+
+void TraceThreadName(const char *strName)
+{
+	uint32 tid;
+
+	if (Trace.pEvents == NULL)
+		return;
+	tid = CurrentThreadId();
+	if (tid <= TRACE_MAX_THREADS)
+	{
+		__atomic_store_n(&Trace.strThreadNames[tid - 1], strName, __ATOMIC_RELAXED);
+	}
+}
+
+/*! @brief Copy the event of the given index out of the ring; FALSE if it
+ * was overwritten or is being written. */
+static bool ReadEvent(uint32 index, struct TRACE_EVENT *pCopy)
+{
+	struct TRACE_EVENT *pEvent = &Trace.pEvents[index % TRACE_RING_SIZE];
+	const uint32 seq = __atomic_load_n(&pEvent->seq, __ATOMIC_ACQUIRE);
+
+	if (seq != index + 1)
+		return FALSE;
+	pCopy->sec = __atomic_load_n(&pEvent->sec, __ATOMIC_RELAXED);
+	pCopy->nsec = __atomic_load_n(&pEvent->nsec, __ATOMIC_RELAXED);
+	pCopy->durationUs = __atomic_load_n(&pEvent->durationUs, __ATOMIC_RELAXED);
+	pCopy->strName = __atomic_load_n(&pEvent->strName, __ATOMIC_RELAXED);
+	pCopy->arg = __atomic_load_n(&pEvent->arg, __ATOMIC_RELAXED);
+	pCopy->tid = __atomic_load_n(&pEvent->tid, __ATOMIC_RELAXED);
+	pCopy->phase = __atomic_load_n(&pEvent->phase, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&pEvent->seq, __ATOMIC_RELAXED) == seq;
+}
+
+OSC_ERR TraceDump(void)
+{
+	const uint32 head = __atomic_load_n(&Trace.head, __ATOMIC_ACQUIRE);
+	const uint32 nThreads = __atomic_load_n(&Trace.nThreads, __ATOMIC_RELAXED);
+	uint32 index, tid, nLost = 0;
+	struct TRACE_EVENT event;
+
+	if (Trace.pEvents == NULL)
+		return SUCCESS;
+
+	/* replace the last trace */
+	rewind(Trace.pFile);
+	if (ftruncate(fileno(Trace.pFile), 0) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to truncate the trace file!\n", __func__);
+		return -EDEVICE;
+	}
+	fprintf(Trace.pFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(Trace.pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"template\"}}");
+	for (tid = 1; tid <= nThreads && tid <= TRACE_MAX_THREADS; tid++)
+	{
+		const char *strName = __atomic_load_n(&Trace.strThreadNames[tid - 1], __ATOMIC_RELAXED);
+
+		if (strName != NULL)
+		{
+			fprintf(Trace.pFile, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+					(unsigned int)tid, strName);
+		}
+	}
+
+	/* the events still in the ring, oldest first */
+	for (index = head < TRACE_RING_SIZE ? 0 : head - TRACE_RING_SIZE; index != head; index++)
+	{
+		if (!ReadEvent(index, &event))
+		{
+			nLost++;
+			continue;
+		}
+		fprintf(Trace.pFile, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%llu.%03u",
+				event.strName, (char)event.phase, (unsigned int)event.tid,
+				(unsigned long long)event.sec * 1000000 + event.nsec / 1000,
+				(unsigned int)(event.nsec % 1000));
+		if (event.phase == 'X')
+		{
+			fprintf(Trace.pFile, ",\"dur\":%u", (unsigned int)event.durationUs);
+		}
+		if (event.phase != 'E')
+		{
+			fprintf(Trace.pFile, ",\"args\":{\"arg\":%u}", (unsigned int)event.arg);
+		}
+		fputc('}', Trace.pFile);
+	}
+	fprintf(Trace.pFile, "\n]}\n");
+	if (fflush(Trace.pFile) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to write the trace file!\n", __func__);
+		return -EDEVICE;
+	}
+	OscLog(INFO, "%s: %u events written, %u overwritten while writing.\n", __func__,
+			(unsigned int)(head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE) - nLost, (unsigned int)nLost);
+	return SUCCESS;
+}
+
+OSC_ERR TraceStart(const char *strFileName)
+{
+	sigset_t signals;
+
+	Trace.pFile = fopen(strFileName, "w");
+	if (Trace.pFile == NULL)
+	{
+		OscLog(ERROR, "%s: Unable to open %s!\n", __func__, strFileName);
+		return -EUNABLE_TO_OPEN_FILE;
+	}
+	setvbuf(Trace.pFile, FileBuffer, _IOFBF, sizeof(FileBuffer));
+
+	/* SIGUSR1 is only read from the signalfd */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	Trace.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (Trace.signalFd < 0 || pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+	{
+		OscLog(ERROR, "%s: Unable to receive SIGUSR1!\n", __func__);
+		TraceStop();
+		return -EDEVICE;
+	}
+
+	Trace.pEvents = calloc(TRACE_RING_SIZE, sizeof(struct TRACE_EVENT));
+	if (Trace.pEvents == NULL)
+	{
+		OscLog(ERROR, "%s: Unable to allocate the trace ring!\n", __func__);
+		TraceStop();
+		return -EOUT_OF_MEMORY;
+	}
+	return SUCCESS;
+}
+
+void TraceStop(void)
+{
+	if (Trace.pEvents != NULL)
+	{
+		TraceDump();
+	}
+	if (Trace.signalFd >= 0)
+	{
+		close(Trace.signalFd);
+		Trace.signalFd = -1;
+	}
+	if (Trace.pFile != NULL)
+	{
+		fclose(Trace.pFile);
+		Trace.pFile = NULL;
+	}
+	free(Trace.pEvents);
+	Trace.pEvents = NULL;
+}
+
+int TraceFd(void)
+{
+	return Trace.signalFd;
+}
@@ -0,0 +1,89 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file trace.h
+ * @brief Spans of the frame pipeline recorded for a timeline view.
+ *
+ * Tracing is off unless TraceStart was called (command line option -t).
+ * The spans of all threads go into one ring of fixed size allocated at
+ * the start; the oldest are overwritten, recording never blocks. The ring
+ * is written to the trace file as Chrome trace-event JSON (to be opened
+ * with chrome://tracing or Perfetto) whenever the application receives
+ * SIGUSR1 and when it terminates.
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "oscar.h"
+
+/*! @brief Number of events the ring holds, a power of two. */
+#define TRACE_RING_SIZE 16384
+
+/*! @brief Maximal number of threads with a name in the trace. */
+#define TRACE_MAX_THREADS 16
+
+/*********************************************************************//*!
+ * @brief Allocate the ring, open the trace file and block SIGUSR1.
+ *
+ * Has to be called before any other thread is started, so that SIGUSR1
+ * is blocked in all of them and only read from TraceFd().
+ *
+ * @param strFileName The file the trace is written to.
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR TraceStart(const char *strFileName);
+
+/*********************************************************************//*!
+ * @brief Write the trace a last time and release the ring.
+ *//*********************************************************************/
+void TraceStop(void);
+
+/*********************************************************************//*!
+ * @brief The signalfd readable on SIGUSR1, the request to write the trace.
+ *
+ * @return The file descriptor, -1 if tracing is off.
+ *//*********************************************************************/
+int TraceFd(void);
+
+/*********************************************************************//*!
+ * @brief Write the events in the ring to the trace file, replacing its
+ * previous content. Allocates no memory.
+ *
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR TraceDump(void);
+
+/*********************************************************************//*!
+ * @brief Name the calling thread in the trace.
+ *
+ * @param strName The name, a string constant.
+ *//*********************************************************************/
+void TraceThreadName(const char *strName);
+
+/*********************************************************************//*!
+ * @brief Begin a span of the calling thread.
+ *
+ * @param strName The name of the span, a string constant.
+ * @param arg A number shown with the span (a frame, a parameter ID).
+ *//*********************************************************************/
+void TraceBegin(const char *strName, uint32 arg);
+
+/*********************************************************************//*!
+ * @brief End the last span begun by the calling thread.
+ *
+ * @param strName The name of the span, a string constant.
+ *//*********************************************************************/
+void TraceEnd(const char *strName);
+
+/*********************************************************************//*!
+ * @brief Record a span of the calling thread which ends now.
+ *
+ * @param strName The name of the span, a string constant.
+ * @param arg A number shown with the span.
+ * @param durationUs How long the span took (us).
+ *//*********************************************************************/
+void TraceSpan(const char *strName, uint32 arg, uint32 durationUs);
+
+#endif /*TRACE_H_*/
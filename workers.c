@@ -0,0 +1,286 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file workers.c
+ * @brief Persistent pool of threads executing kernel tiles with work
+ * stealing.
+ */
+
+#include "workers.h"
+#include <pthread.h>
+#include <time.h>
+
+/*! @brief A worker's deque of tiles and its counters, on a cache line of
+ * their own.
+ *
+ * All tiles of a kernel are dealt before the kernel starts, so a deque
+ * only ever shrinks while it is in use: the owner takes from the back,
+ * thieves from the front. Both ends live in one word (front in the lower,
+ * back in the upper half) which is updated by compare and swap, so the
+ * last tile goes to exactly one of them without a lock. */
+struct WORKER
+{
+	volatile uint32 ends;
+	uint16 tiles[MAX_TILES];
+	struct WORKER_STATS stats;
+} __attribute__((aligned(64)));
+
+static struct WORKER Workers[MAX_WORKERS];
+
+/*! @brief The pool; the fields are protected by the lock. */
+static struct
+{
+	pthread_mutex_t lock;
+	/*! @brief Signaled when a new kernel is posted or the pool stops. */
+	pthread_cond_t start;
+	/*! @brief Signaled when the last worker is out of tiles. */
+	pthread_cond_t done;
+	pthread_t threads[MAX_WORKERS];
+	int nWorkers;
+	/*! @brief Incremented with every kernel, tells the workers a new
+	 * kernel from the one they did last. */
+	uint32 job;
+	/*! @brief Number of extra threads still taking tiles of the current
+	 * kernel. */
+	int nPending;
+	bool bStop;
+	/*! @brief The current kernel. */
+	TILE_FUNC func;
+	void *pContext;
+	/*! @brief Wall time spent in kernels (ns). */
+	uint64_t kernelNs;
+} Pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER
+};
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*! @brief Read both ends of a deque at once.
+ *
+ * An atomic no-op rather than a plain load, so that the read is ordered
+ * with the compare and swap of the other workers. */
+static uint32 LoadEnds(struct WORKER *pWorker)
+{
+	return __sync_fetch_and_add(&pWorker->ends, 0);
+}
+
+/*! @brief Take the tile at the back of the own deque, -1 if empty. */
+static int PopTile(struct WORKER *pWorker)
+{
+	for (;;)
+	{
+		const uint32 ends = LoadEnds(pWorker);
+		const uint32 front = ends & 0xffff, back = ends >> 16;
+
+		if (front == back)
+			return -1;
+		if (__sync_bool_compare_and_swap(&pWorker->ends, ends, front | ((back - 1) << 16)))
+			return pWorker->tiles[back - 1];
+	}
+}
+
+/*! @brief Take the tile at the front of another worker's deque, -1 if
+ * empty. */
+static int StealTile(struct WORKER *pVictim)
+{
+	for (;;)
+	{
+		const uint32 ends = LoadEnds(pVictim);
+		const uint32 front = ends & 0xffff, back = ends >> 16;
+
+		if (front == back)
+			return -1;
+		if (__sync_bool_compare_and_swap(&pVictim->ends, ends, (front + 1) | (back << 16)))
+			return pVictim->tiles[front];
+	}
+}
+
+/*! @brief Execute tiles until all deques are empty. */
+static void RunTiles(int iWorker, TILE_FUNC func, void *pContext)
+{
+	struct WORKER *pWorker = &Workers[iWorker];
+	const int n = Pool.nWorkers;
+
+	for (;;)
+	{
+		int tile = PopTile(pWorker);
+		bool bStolen = FALSE;
+		uint64_t t0;
+		int k;
+
+		/* the own deque is empty, try the others starting with the next */
+		for (k = 1; tile < 0 && k < n; k++)
+		{
+			tile = StealTile(&Workers[(iWorker + k) % n]);
+			bStolen = TRUE;
+		}
+		if (tile < 0)
+			return;
+
+		t0 = NowNs();
+		func(iWorker, tile, pContext);
+		pWorker->stats.busyNs += NowNs() - t0;
+		pWorker->stats.nTiles++;
+		pWorker->stats.nStolen += bStolen;
+	}
+}
+
+static void *WorkerLoop(void *pArg)
+{
+	const int iWorker = (int)(long)pArg;
+	uint32 lastJob = 0;
+
+	pthread_mutex_lock(&Pool.lock);
+	for (;;)
+	{
+		TILE_FUNC func;
+		void *pContext;
+
+		while (!Pool.bStop && Pool.job == lastJob)
+			pthread_cond_wait(&Pool.start, &Pool.lock);
+		if (Pool.bStop)
+			break;
+		lastJob = Pool.job;
+		func = Pool.func;
+		pContext = Pool.pContext;
+		pthread_mutex_unlock(&Pool.lock);
+
+		RunTiles(iWorker, func, pContext);
+
+		/* no tile of this kernel is left anywhere, the next kernel may
+		 * only deal its tiles once every worker is out of here */
+		pthread_mutex_lock(&Pool.lock);
+		if (--Pool.nPending == 0)
+			pthread_cond_signal(&Pool.done);
+	}
+	pthread_mutex_unlock(&Pool.lock);
+	return NULL;
+}
+
+OSC_ERR WorkersStart(int nWorkers)
+{
+	int i;
+
+	if (nWorkers < 1 || nWorkers > MAX_WORKERS)
+	{
+		OscLog(ERROR, "%s: Invalid number of workers (%d)!\n", __func__, nWorkers);
+		return -EINVALID_PARAMETER;
+	}
+	/* no worker is alive, so the job counter the new ones start from
+	 * can be reset */
+	Pool.bStop = FALSE;
+	Pool.job = 0;
+	Pool.nWorkers = 1;
+	/* worker 0 is the calling thread */
+	for (i = 1; i < nWorkers; i++)
+	{
+		if (pthread_create(&Pool.threads[i], NULL, WorkerLoop, (void*)(long)i) != 0)
+		{
+			OscLog(ERROR, "%s: Unable to start worker %d!\n", __func__, i);
+			WorkersStop();
+			return -EDEVICE;
+		}
+		Pool.nWorkers++;
+	}
+	WorkersResetStats();
+	return SUCCESS;
+}
+
+void WorkersStop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&Pool.lock);
+	Pool.bStop = TRUE;
+	pthread_cond_broadcast(&Pool.start);
+	pthread_mutex_unlock(&Pool.lock);
+	for (i = 1; i < Pool.nWorkers; i++)
+	{
+		pthread_join(Pool.threads[i], NULL);
+	}
+	Pool.nWorkers = 1;
+}
+
+int WorkersCount(void)
+{
+	return Pool.nWorkers > 1 ? Pool.nWorkers : 1;
+}
+
+void WorkersRunTiles(int nTiles, TILE_FUNC func, void *pContext)
+{
+	const int n = WorkersCount();
+	const uint64_t t0 = NowNs();
+	uint32 count[MAX_WORKERS] = { 0 };
+	int i;
+
+	if (nTiles > MAX_TILES)
+	{
+		OscLog(ERROR, "%s: Too many tiles (%d)!\n", __func__, nTiles);
+		nTiles = MAX_TILES;
+	}
+	/* deal the tiles round robin, neighboring tiles go to different
+	 * workers */
+	for (i = 0; i < nTiles; i++)
+	{
+		Workers[i % n].tiles[count[i % n]++] = i;
+	}
+	for (i = 0; i < n; i++)
+	{
+		Workers[i].ends = count[i] << 16;
+	}
+
+	if (n > 1)
+	{
+		pthread_mutex_lock(&Pool.lock);
+		Pool.func = func;
+		Pool.pContext = pContext;
+		Pool.nPending = n - 1;
+		Pool.job++;
+		pthread_cond_broadcast(&Pool.start);
+		pthread_mutex_unlock(&Pool.lock);
+	}
+
+	RunTiles(0, func, pContext);
+
+	if (n > 1)
+	{
+		pthread_mutex_lock(&Pool.lock);
+		while (Pool.nPending > 0)
+			pthread_cond_wait(&Pool.done, &Pool.lock);
+		pthread_mutex_unlock(&Pool.lock);
+	}
+	Pool.kernelNs += NowNs() - t0;
+}
+
+void WorkersResetStats(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_WORKERS; i++)
+	{
+		Workers[i].stats.busyNs = 0;
+		Workers[i].stats.nTiles = 0;
+		Workers[i].stats.nStolen = 0;
+	}
+	Pool.kernelNs = 0;
+}
+
+const struct WORKER_STATS *WorkersGetStats(int iWorker)
+{
+	return &Workers[iWorker].stats;
+}
+
+uint64_t WorkersKernelNs(void)
+{
+	return Pool.kernelNs;
+}
@@ -0,0 +1,102 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file workers.h
+ * @brief Persistent pool of threads executing tiles of a kernel with work
+ * stealing.
+ *
+ * A kernel is split into tiles (bands of rows, objects, ...) that are
+ * dealt round robin to a deque per worker. Every worker takes tiles from
+ * the back of its own deque and, when that is empty, steals from the front
+ * of the others, so workers whose tiles turn out cheap help the ones with
+ * expensive tiles. The calling thread is worker 0, a pool of n workers
+ * runs n - 1 extra threads which sleep between kernels.
+ */
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+#include "oscar.h"
+#include <stdint.h>
+
+/*! @brief Maximal number of workers including the calling thread. */
+#define MAX_WORKERS 8
+
+/*! @brief Maximal number of tiles of a kernel. */
+#define MAX_TILES 1024
+
+/*! @brief Processes tile iTile on worker iWorker; per-thread resources
+ * are selected by iWorker. */
+typedef void (*TILE_FUNC)(int iWorker, int iTile, void *pContext);
+
+/*! @brief Counters of a worker since the last WorkersResetStats. */
+struct WORKER_STATS
+{
+	/*! @brief Time spent executing tiles (ns). */
+	uint64_t busyNs;
+	/*! @brief Number of tiles executed. */
+	uint32 nTiles;
+	/*! @brief Number of those taken from another worker's deque. */
+	uint32 nStolen;
+};
+
+/*********************************************************************//*!
+ * @brief Create the worker threads.
+ *
+ * @param nWorkers Number of workers including the calling thread
+ * (1 ... MAX_WORKERS).
+ * @return SUCCESS or an appropriate error code.
+ *//*********************************************************************/
+OSC_ERR WorkersStart(int nWorkers);
+
+/*********************************************************************//*!
+ * @brief Terminate the worker threads.
+ *//*********************************************************************/
+void WorkersStop(void);
+
+/*********************************************************************//*!
+ * @brief The number of workers.
+ *
+ * @return The number of workers, 1 if the pool was not started.
+ *//*********************************************************************/
+int WorkersCount(void);
+
+/*********************************************************************//*!
+ * @brief Execute the tiles 0 ... nTiles - 1 of a kernel on all workers;
+ * returns when all tiles are done.
+ *
+ * Tiles are executed in no particular order and must not depend on each
+ * other.
+ *
+ * @param nTiles Number of tiles (at most MAX_TILES).
+ * @param func The function executing a tile.
+ * @param pContext Passed to func.
+ *//*********************************************************************/
+void WorkersRunTiles(int nTiles, TILE_FUNC func, void *pContext);
+
+/*********************************************************************//*!
+ * @brief Clear the counters of all workers and the kernel time.
+ *//*********************************************************************/
+void WorkersResetStats(void);
+
+/*********************************************************************//*!
+ * @brief The counters of a worker.
+ *
+ * Only valid between kernels.
+ *
+ * @param iWorker The worker.
+ * @return The counters.
+ *//*********************************************************************/
+const struct WORKER_STATS *WorkersGetStats(int iWorker);
+
+/*********************************************************************//*!
+ * @brief Wall time spent in WorkersRunTiles since the last
+ * WorkersResetStats (ns); a worker's busy time relative to this is its
+ * utilization.
+ *
+ * @return The time.
+ *//*********************************************************************/
+uint64_t WorkersKernelNs(void);
+
+#endif /*WORKERS_H_*/
@@ -0,0 +1,131 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file ycbcr.c
+ * @brief Fixed-point BGR to YCbCr conversion (scalar, NEON and SSE2).
+ */
+
+#include "ycbcr.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YCBCR_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define YCBCR_SSE2
+#endif
+
+/*! @brief Convert a single pixel; this is the reference all vector paths
+ * have to match. All intermediate sums are non-negative and fit into
+ * 32 bit, so the shift truncates like the former float to uint8 cast. */
+static inline void Bgr2YCbCrPixel(const uint8 *pBgr, uint8 *pYCbCr)
+{
+	int32 B = pBgr[0], G = pBgr[1], R = pBgr[2];
+
+	pYCbCr[0] = (uint8) ((YCBCR_Y_R*R + YCBCR_Y_G*G + YCBCR_Y_B*B) >> YCBCR_FRAC_BITS);
+	pYCbCr[1] = (uint8) ((YCBCR_CHROMA_OFFSET + YCBCR_CB_R*R + YCBCR_CB_G*G + YCBCR_CB_B*B) >> YCBCR_FRAC_BITS);
+	pYCbCr[2] = (uint8) ((YCBCR_CHROMA_OFFSET + YCBCR_CR_R*R + YCBCR_CR_G*G + YCBCR_CR_B*B) >> YCBCR_FRAC_BITS);
+}
+
+#ifdef YCBCR_NEON
+/*! @brief One output channel for 8 pixels: (off + cR*R + cG*G + cB*B) >> 15 */
+static inline uint8x8_t Bgr2YCbCrChannel_neon(int16x8_t R, int16x8_t G, int16x8_t B,
+		int16 cR, int16 cG, int16 cB, int32x4_t off)
+{
+	int32x4_t lo = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(off, vget_low_s16(R), cR), vget_low_s16(G), cG), vget_low_s16(B), cB);
+	int32x4_t hi = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(off, vget_high_s16(R), cR), vget_high_s16(G), cG), vget_high_s16(B), cB);
+	int16x8_t res = vcombine_s16(vshrn_n_s32(lo, YCBCR_FRAC_BITS), vshrn_n_s32(hi, YCBCR_FRAC_BITS));
+	return vqmovun_s16(res);
+}
+
+/*! @brief Convert 8 pixels at once; returns the number of pixels done. */
+static uint32 Bgr2YCbCr_neon(const uint8 *pBgr, uint8 *pYCbCr, uint32 nPixels)
+{
+	const int32x4_t zero = vdupq_n_s32(0);
+	const int32x4_t off = vdupq_n_s32(YCBCR_CHROMA_OFFSET);
+	uint32 i;
+
+	for (i = 0; i + 8 <= nPixels; i += 8)
+	{
+		uint8x8x3_t bgr = vld3_u8(pBgr + 3*i);
+		uint8x8x3_t ycc;
+		int16x8_t B = vreinterpretq_s16_u16(vmovl_u8(bgr.val[0]));
+		int16x8_t G = vreinterpretq_s16_u16(vmovl_u8(bgr.val[1]));
+		int16x8_t R = vreinterpretq_s16_u16(vmovl_u8(bgr.val[2]));
+
+		ycc.val[0] = Bgr2YCbCrChannel_neon(R, G, B, YCBCR_Y_R, YCBCR_Y_G, YCBCR_Y_B, zero);
+		ycc.val[1] = Bgr2YCbCrChannel_neon(R, G, B, YCBCR_CB_R, YCBCR_CB_G, YCBCR_CB_B, off);
+		ycc.val[2] = Bgr2YCbCrChannel_neon(R, G, B, YCBCR_CR_R, YCBCR_CR_G, YCBCR_CR_B, off);
+		vst3_u8(pYCbCr + 3*i, ycc);
+	}
+	return i;
+}
+#endif /* YCBCR_NEON */
+
+#ifdef YCBCR_SSE2
+/*! @brief One output channel for 8 pixels using pairwise multiply-add of
+ * (R,G) and (B,0) pairs: (off + cR*R + cG*G + cB*B) >> 15 */
+static inline __m128i Bgr2YCbCrChannel_sse2(__m128i RGlo, __m128i RGhi, __m128i B0lo, __m128i B0hi,
+		int16 cR, int16 cG, int16 cB, __m128i off)
+{
+	const __m128i kRG = _mm_setr_epi16(cR, cG, cR, cG, cR, cG, cR, cG);
+	const __m128i kB = _mm_setr_epi16(cB, 0, cB, 0, cB, 0, cB, 0);
+	__m128i lo = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(RGlo, kRG), _mm_madd_epi16(B0lo, kB)), off);
+	__m128i hi = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(RGhi, kRG), _mm_madd_epi16(B0hi, kB)), off);
+	lo = _mm_srai_epi32(lo, YCBCR_FRAC_BITS);
+	hi = _mm_srai_epi32(hi, YCBCR_FRAC_BITS);
+	return _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+}
+
+/*! @brief Convert 8 pixels at once; returns the number of pixels done.
+ * SSE2 has no byte shuffle, so the channels are gathered with 16 bit
+ * inserts; the arithmetic itself is fully vectorized. */
+static uint32 Bgr2YCbCr_sse2(const uint8 *pBgr, uint8 *pYCbCr, uint32 nPixels)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i off = _mm_set1_epi32(YCBCR_CHROMA_OFFSET);
+	uint32 i;
+	int k;
+
+	for (i = 0; i + 8 <= nPixels; i += 8)
+	{
+		const uint8 *p = pBgr + 3*i;
+		uint8 *q = pYCbCr + 3*i;
+		uint8 out[3][16];
+		__m128i B = _mm_setr_epi16(p[0], p[3], p[6], p[9], p[12], p[15], p[18], p[21]);
+		__m128i G = _mm_setr_epi16(p[1], p[4], p[7], p[10], p[13], p[16], p[19], p[22]);
+		__m128i R = _mm_setr_epi16(p[2], p[5], p[8], p[11], p[14], p[17], p[20], p[23]);
+		__m128i RGlo = _mm_unpacklo_epi16(R, G), RGhi = _mm_unpackhi_epi16(R, G);
+		__m128i B0lo = _mm_unpacklo_epi16(B, zero), B0hi = _mm_unpackhi_epi16(B, zero);
+
+		_mm_storeu_si128((__m128i*)out[0], Bgr2YCbCrChannel_sse2(RGlo, RGhi, B0lo, B0hi, YCBCR_Y_R, YCBCR_Y_G, YCBCR_Y_B, zero));
+		_mm_storeu_si128((__m128i*)out[1], Bgr2YCbCrChannel_sse2(RGlo, RGhi, B0lo, B0hi, YCBCR_CB_R, YCBCR_CB_G, YCBCR_CB_B, off));
+		_mm_storeu_si128((__m128i*)out[2], Bgr2YCbCrChannel_sse2(RGlo, RGhi, B0lo, B0hi, YCBCR_CR_R, YCBCR_CR_G, YCBCR_CR_B, off));
+		for (k = 0; k < 8; k++)
+		{
+			q[3*k + 0] = out[0][k];
+			q[3*k + 1] = out[1][k];
+			q[3*k + 2] = out[2][k];
+		}
+	}
+	return i;
+}
+#endif /* YCBCR_SSE2 */
+
+void Bgr2YCbCr(const uint8 *pBgr, uint8 *pYCbCr, uint32 nPixels)
+{
+	uint32 i = 0;
+
+#if defined(YCBCR_NEON)
+	i = Bgr2YCbCr_neon(pBgr, pYCbCr, nPixels);
+#elif defined(YCBCR_SSE2)
+	i = Bgr2YCbCr_sse2(pBgr, pYCbCr, nPixels);
+#endif
+	/* scalar path for the remaining pixels (or all of them) */
+	for (; i < nPixels; i++)
+	{
+		Bgr2YCbCrPixel(pBgr + 3*i, pYCbCr + 3*i);
+	}
+}
@@ -0,0 +1,49 @@
+/* Copying and distribution of this file, with or without modification,
+ * are permitted in any medium without royalty. This file is offered as-is,
+ * without any warranty.
+ */
+
+/*! @file ycbcr.h
+ * @brief Integer-only color space conversion from the BGR sensor image to
+ * YCbCr.
+ *
+ * All code paths (scalar, NEON and SSE2) use the same Q15 coefficients and
+ * the same exact 32 bit integer arithmetic, so the result is bit-identical
+ * on host and target.
+ */
+#ifndef YCBCR_H_
+#define YCBCR_H_
+
+#include "oscar.h"
+
+/*! @brief Number of fractional bits of the conversion coefficients. */
+#define YCBCR_FRAC_BITS 15
+
+/*! @brief Q15 coefficients of the conversion (0.299, 0.587, 0.114, ...). */
+#define YCBCR_Y_R 9798
+#define YCBCR_Y_G 19235
+#define YCBCR_Y_B 3736
+#define YCBCR_CB_R (-5538)
+#define YCBCR_CB_G (-10846)
+#define YCBCR_CB_B 16384
+#define YCBCR_CR_R 16384
+#define YCBCR_CR_G (-13730)
+#define YCBCR_CR_B (-2654)
+
+/*! @brief Offset of the chroma channels in Q15. */
+#define YCBCR_CHROMA_OFFSET (128 << YCBCR_FRAC_BITS)
+
+/*********************************************************************//*!
+ * @brief Convert a line of interleaved BGR pixels to interleaved YCbCr.
+ *
+ * Uses the vector unit of the build target if available (NEON or SSE2)
+ * and a scalar implementation for the remaining pixels. The results are
+ * truncated like the former floating point conversion.
+ *
+ * @param pBgr Source pixels, 3 bytes per pixel (order B, G, R).
+ * @param pYCbCr Destination pixels, 3 bytes per pixel (order Y, Cb, Cr).
+ * @param nPixels Number of pixels to convert.
+ *//*********************************************************************/
+void Bgr2YCbCr(const uint8 *pBgr, uint8 *pYCbCr, uint32 nPixels);
+
+#endif /*YCBCR_H_*/